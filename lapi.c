@@ -115,6 +115,28 @@ LUA_API int lua_checkstack (lua_State *L, int n) {
 }
 
 
+static void reallocstack (lua_State *L, void *ud) {
+  luaD_reallocstack(L, *(int *)ud);
+}
+
+
+//设置线程栈大小的提示：栈立即增长到能容纳n个槽位，此后收缩时不会低于该大小。
+LUA_API int lua_setstackhint (lua_State *L, int n) {
+  int res = 1;
+  int size;
+  lua_lock(L);
+  api_check(L, n >= 0, "negative 'n'");
+  if (n > LUAI_MAXSTACK - EXTRA_STACK)
+    n = LUAI_MAXSTACK - EXTRA_STACK;
+  size = n + EXTRA_STACK;
+  L->stackhint = size;
+  if (size > L->stacksize)  /* grow it now, capturing memory errors */
+    res = (luaD_rawrunprotected(L, &reallocstack, &size) == LUA_OK);
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void lua_xmove (lua_State *from, lua_State *to, int n) {
   int i;
   if (from == to) return;
@@ -858,6 +880,197 @@ LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
   lua_unlock(L);
 }
 
+/*
+** {======================================================
+** Bulk transfers between C arrays and 't[start .. start + n - 1]'
+** =======================================================
+*/
+
+/* key of the i-th element (wraps around instead of overflowing) */
+#define bulkkey(start,i)	l_castU2S(l_castS2U(start) + cast(lua_Unsigned, i))
+
+
+static Table *bulktable (lua_State *L, int idx, int n) {
+  StkId o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  api_check(L, n >= 0, "negative count");
+  UNUSED(n);
+  return hvalue(o);
+}
+
+
+//批量原始赋值：把C数组v中的n个浮点数存入t[start..start+n-1]。
+LUA_API void lua_rawsetarray (lua_State *L, int idx, lua_Integer start,
+                              int n, const lua_Number *v) {
+  Table *t;
+  TValue *a;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, n);
+  a = (n > 0) ? luaH_arrayrange(L, t, start, n) : NULL;
+  if (a != NULL) {  /* whole range in the array part? */
+    for (i = 0; i < n; i++)
+      setfltvalue(a + i, v[i]);
+  }
+  else {
+    TValue aux;
+    for (i = 0; i < n; i++) {
+      setfltvalue(&aux, v[i]);
+      luaH_setint(L, t, bulkkey(start, i), &aux);
+    }
+  }
+  lua_unlock(L);
+}
+
+
+//批量原始赋值：把C数组v中的n个整数存入t[start..start+n-1]。
+LUA_API void lua_rawsetiarray (lua_State *L, int idx, lua_Integer start,
+                               int n, const lua_Integer *v) {
+  Table *t;
+  TValue *a;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, n);
+  a = (n > 0) ? luaH_arrayrange(L, t, start, n) : NULL;
+  if (a != NULL) {  /* whole range in the array part? */
+    for (i = 0; i < n; i++)
+      setivalue(a + i, v[i]);
+  }
+  else {
+    TValue aux;
+    for (i = 0; i < n; i++) {
+      setivalue(&aux, v[i]);
+      luaH_setint(L, t, bulkkey(start, i), &aux);
+    }
+  }
+  lua_unlock(L);
+}
+
+
+/*
+** Store strings 's[0 .. n-1]' (with lengths 'len', or zero-terminated if
+** 'len' is NULL) into 't[start .. start + n - 1]'; NULL entries store nil.
+*/
+//批量原始赋值：把C字符串数组s中的n个字符串存入t[start..start+n-1]。
+LUA_API void lua_rawsetsarray (lua_State *L, int idx, lua_Integer start,
+                               int n, const char *const *s,
+                               const size_t *len) {
+  Table *t;
+  TValue *a;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, n);
+  a = (n > 0) ? luaH_arrayrange(L, t, start, n) : NULL;
+  for (i = 0; i < n; i++) {
+    if (a != NULL) {  /* array part: store directly */
+      if (s[i] == NULL)
+        setnilvalue(a + i);
+      else {
+        size_t l = (len != NULL) ? len[i] : strlen(s[i]);
+        setsvalue(L, a + i, luaS_newlstr(L, s[i], l));
+      }
+      luaC_barrierback(L, t, a + i);
+    }
+    else {  /* hash part: 'luaH_setint' may collect, so anchor the string */
+      if (s[i] == NULL)
+        setnilvalue(L->top);
+      else {
+        size_t l = (len != NULL) ? len[i] : strlen(s[i]);
+        setsvalue2s(L, L->top, luaS_newlstr(L, s[i], l));
+      }
+      api_incr_top(L);
+      luaH_setint(L, t, bulkkey(start, i), L->top - 1);
+      luaC_barrierback(L, t, L->top - 1);
+      L->top--;
+    }
+  }
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
+//批量原始读取：把t[start..start+n-1]转换为浮点数存入v；返回从头起成功转换的个数。
+LUA_API int lua_rawgetarray (lua_State *L, int idx, lua_Integer start,
+                             int n, lua_Number *v) {
+  Table *t;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, n);
+  for (i = 0; i < n; i++) {
+    if (!tonumber(luaH_getint(t, bulkkey(start, i)), &v[i]))
+      break;  /* not a number */
+  }
+  lua_unlock(L);
+  return i;
+}
+
+
+//批量原始读取：把t[start..start+n-1]转换为整数存入v；返回从头起成功转换的个数。
+LUA_API int lua_rawgetiarray (lua_State *L, int idx, lua_Integer start,
+                              int n, lua_Integer *v) {
+  Table *t;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, n);
+  for (i = 0; i < n; i++) {
+    if (!tointeger(luaH_getint(t, bulkkey(start, i)), &v[i]))
+      break;  /* not an integer */
+  }
+  lua_unlock(L);
+  return i;
+}
+
+
+/*
+** Sort 't[1 .. n]' in place with the primitive '<' when all those
+** values are in the array part and are all numbers (no NaN) or all
+** strings; return 0 without touching the table otherwise.
+*/
+//原生排序：t[1..n]全是数字（无NaN）或全是字符串时，直接在数组部分原地升序排序；否则返回0。
+LUA_API int lua_rawsort (lua_State *L, int idx, lua_Integer n) {
+  Table *t;
+  int res;
+  lua_lock(L);
+  t = bulktable(L, idx, 0);
+  res = (0 <= n && l_castS2U(n) <= t->sizearray &&
+         luaH_sortarray(L, t, cast(unsigned int, n)));
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Stable version of 'lua_rawsort' that orders 't[1 .. n]' by the keys
+** 'k[1 .. n]' of the table at 'kidx' (which may be the same table)
+*/
+//按键稳定排序：按kidx处表的k[1..n]对t[1..n]做稳定排序；键须全是数字（无NaN）或全是字符串，否则返回0。
+LUA_API int lua_rawsortby (lua_State *L, int idx, int kidx, lua_Integer n) {
+  Table *t, *k;
+  int res;
+  lua_lock(L);
+  t = bulktable(L, idx, 0);
+  k = bulktable(L, kidx, 0);
+  res = (0 <= n && l_castS2U(n) <= t->sizearray &&
+         l_castS2U(n) <= k->sizearray &&
+         luaH_sortarrayby(L, t, k, cast(unsigned int, n)));
+  lua_unlock(L);
+  return res;
+}
+
+/* }====================================================== */
+
+
+//清空给定索引处的表，但保留其已分配的数组部分和哈希部分。
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId o;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  luaH_clear(hvalue(o));
+  invalidateTMcache(hvalue(o));
+  lua_unlock(L);
+}
+
 //从堆栈中弹出一个表并将其设置为给定索引处的值的新元数据。
 LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   TValue *obj;
@@ -1005,6 +1218,7 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 //加载Lua块而不运行它。如果没有错误， lua_load则将编译后的块作为Lua函数推入堆栈顶部。否则，它会推送一条错误消息。
+//mode含'z'时二进制块会直接引用reader的缓冲区，只能用于缓冲区比加载出的函数活得更久的reader。
 LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
                       const char *chunkname, const char *mode) {
   ZIO z;
@@ -1037,13 +1251,98 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   api_checknelems(L, 1);
   o = L->top - 1;
   if (isLfunction(o))
-    status = luaU_dump(L, getproto(o), writer, data, strip);
+    status = luaU_dump(L, getproto(o), writer, data, strip, 0);
   else
     status = 1;
   lua_unlock(L);
   return status;
 }
 
+/*
+** {======================================================
+** Shared prototypes
+** =======================================================
+*/
+
+static int countdump (lua_State *L, const void *b, size_t size, void *ud) {
+  UNUSED(L); UNUSED(b);
+  *cast(size_t *, ud) += size;
+  return 0;
+}
+
+
+static int copydump (lua_State *L, const void *b, size_t size, void *ud) {
+  char **p = cast(char **, ud);
+  UNUSED(L);
+  memcpy(*p, b, size);
+  *p += size;
+  return 0;
+}
+
+
+//冻结栈顶的Lua函数的原型树，供多个独立的状态机共享。
+LUA_API lua_SharedProto *lua_shareproto (lua_State *L) {
+  lua_SharedProto *sp = NULL;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = L->top - 1;
+  if (isLfunction(o)) {
+    global_State *g = G(L);
+    Proto *f = getproto(o);
+    size_t size = 0;
+    char *p;
+    luaU_dump(L, f, countdump, &size, 0, 1);  /* 1st pass: get size */
+    sp = cast(lua_SharedProto *,
+              (*g->frealloc)(g->ud, NULL, 0, sizeof(USharedProto) + size));
+    if (sp == NULL)
+      luaD_throw(L, LUA_ERRMEM);
+    sp->nref = 1;  /* reference from the caller */
+    sp->frealloc = g->frealloc;
+    sp->ud = g->ud;
+    sp->size = size;
+    p = getimage(sp);
+    luaU_dump(L, f, copydump, &p, 0, 1);  /* 2nd pass: write image */
+    lua_assert(p == getimage(sp) + size);
+  }
+  lua_unlock(L);
+  return sp;
+}
+
+
+static const char *getshared (lua_State *L, void *ud, size_t *size) {
+  lua_SharedProto **psp = cast(lua_SharedProto **, ud);
+  lua_SharedProto *sp = *psp;
+  UNUSED(L);
+  if (sp == NULL) return NULL;
+  *psp = NULL;  /* whole image goes in a single piece */
+  *size = sp->size;
+  return getimage(sp);
+}
+
+
+//在L中以共享原型创建一个新闭包并压栈。
+LUA_API int lua_loadshared (lua_State *L, lua_SharedProto *sp,
+                            const char *chunkname) {
+  lua_SharedProto *rsp = sp;
+  int status = lua_load(L, getshared, &rsp, chunkname, "bz");
+  if (status == LUA_OK) {
+    lua_lock(L);
+    luaF_anchorshared(getproto(L->top - 1), sp);
+    lua_unlock(L);
+  }
+  return status;
+}
+
+
+//释放调用者对共享原型的引用。
+LUA_API void lua_releaseshared (lua_SharedProto *sp) {
+  luaF_releaseshared(sp);
+}
+
+/* }====================================================== */
+
+
 //返回线程的状态L
 LUA_API int lua_status (lua_State *L) {
   return L->status;
@@ -1066,6 +1365,8 @@ LUA_API int lua_status (lua_State *L) {
 	LUA_GCSETPAUSE： 设置data为收集器暂停的新值（请参阅§2.5）并返回暂停的前一个值。
 	LUA_GCSETSTEPMUL： 设置data为收集器步骤乘数的新值（见§2.5）并返回步骤乘数的前一个值。
 	LUA_GCISRUNNING： 返回一个布尔值，告诉收集器是否正在运行（即不停止）。
+	LUA_GCGEN： 将收集器切换到分代模式（data非零时为主收集的增长百分比）并返回之前的模式。
+	LUA_GCINC： 将收集器切换到增量模式并返回之前的模式。
 */
 
 LUA_API int lua_gc (lua_State *L, int what, int data) {
@@ -1110,8 +1411,8 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
-        res = 1;  /* signal it */
+      if (debt > 0 && (g->gcstate == GCSpause || isgenerational(g)))
+        res = 1;  /* end of cycle (or a whole young collection); signal it */
       break;
     }
     case LUA_GCSETPAUSE: {
@@ -1129,6 +1430,26 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      if (data != 0)
+        g->genmajormul = data;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      luaC_changemode(L, KGC_NORMAL);
+      break;
+    }
+    case LUA_GCPARALLEL: {
+      res = luaC_setparallel(L, data);  /* previous number of helpers */
+      break;
+    }
+    case LUA_GCBGFREE: {
+      res = luaC_setbgfree(L, data != 0);  /* previous state */
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1208,6 +1529,7 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 //f 用用户数据 改变给定状态的分配器功能ud。
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaC_setbgalloc(G(L), f, ud);
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
@@ -0,0 +1,537 @@
+/*
+** $Id: larraylib.c $
+** Packed numeric arrays
+** See Copyright Notice in lua.h
+*/
+
+#define larraylib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** An array is a full userdata holding 'n' packed elements of one of the
+** types below, indexed from 1. Element access goes through metamethods;
+** bulk operations run as C loops over the packed data.
+*/
+
+#define LUA_ARRAYHANDLE		"ARRAY*"
+
+#define AFLOAT64	0	/* double */
+#define AINT64		1	/* lua_Integer */
+#define AFLOAT32	2	/* float */
+
+static const char *const typenames[] = {"float64", "int64", "float32", NULL};
+
+static const size_t typesizes[] = {
+  sizeof(double), sizeof(lua_Integer), sizeof(float)
+};
+
+
+typedef struct NumArray {
+  lua_Integer n;  /* number of elements */
+  int type;
+  union {
+    double f64[1];
+    lua_Integer i64[1];
+    float f32[1];
+  } u;
+} NumArray;
+
+
+#define checkarray(L,i)	((NumArray *)luaL_checkudata(L, i, LUA_ARRAYHANDLE))
+
+
+/* number of elements converted at a time between arrays and tables */
+#define CHUNK	((int)(LUAL_BUFFERSIZE / sizeof(lua_Number)))
+
+
+static NumArray *newarray (lua_State *L, int type, lua_Integer n) {
+  NumArray *a;
+  size_t esize = typesizes[type];
+  luaL_argcheck(L, n >= 0, 2, "negative size");
+  if ((lua_Unsigned)n > (((size_t)-1) - sizeof(NumArray)) / esize)
+    luaL_error(L, "array too large");
+  a = (NumArray *)lua_newuserdata(L, offsetof(NumArray, u) +
+                                     (size_t)n * esize + sizeof(a->u));
+  a->n = n;
+  a->type = type;
+  memset(&a->u, 0, (size_t)n * esize);
+  luaL_setmetatable(L, LUA_ARRAYHANDLE);
+  return a;
+}
+
+
+static void pushelem (lua_State *L, const NumArray *a, lua_Integer i) {
+  switch (a->type) {
+    case AFLOAT64: lua_pushnumber(L, (lua_Number)a->u.f64[i]); break;
+    case AINT64: lua_pushinteger(L, a->u.i64[i]); break;
+    default: lua_pushnumber(L, (lua_Number)a->u.f32[i]); break;
+  }
+}
+
+
+static void setelem (lua_State *L, NumArray *a, lua_Integer i, int arg) {
+  switch (a->type) {
+    case AFLOAT64: a->u.f64[i] = (double)luaL_checknumber(L, arg); break;
+    case AINT64: a->u.i64[i] = luaL_checkinteger(L, arg); break;
+    default: a->u.f32[i] = (float)luaL_checknumber(L, arg); break;
+  }
+}
+
+
+/*
+** {======================================================
+** Kernels
+** =======================================================
+*/
+
+/*
+** Reductions and element-wise loops keep four independent lanes, a
+** shape that compilers turn into SIMD code. So, floating-point sums
+** are not added in strict sequential order. Integer arithmetic uses
+** unsigned types to wrap around, as Lua integers do. 'min' and 'max'
+** ignore NaNs wherever they are: the lanes start from the first
+** non-NaN element, and comparisons with NaN are always false.
+*/
+
+#define DEFKERNELS(N,T,A) \
+static A sum_##N (const T *x, lua_Integer n) { \
+  A s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+  lua_Integer i; \
+  for (i = 0; i + 4 <= n; i += 4) { \
+    s0 += (A)x[i]; s1 += (A)x[i + 1]; \
+    s2 += (A)x[i + 2]; s3 += (A)x[i + 3]; \
+  } \
+  for (; i < n; i++) s0 += (A)x[i]; \
+  return (s0 + s1) + (s2 + s3); \
+} \
+static A dot_##N (const T *x, const T *y, lua_Integer n) { \
+  A s0 = 0, s1 = 0, s2 = 0, s3 = 0; \
+  lua_Integer i; \
+  for (i = 0; i + 4 <= n; i += 4) { \
+    s0 += (A)x[i] * (A)y[i]; s1 += (A)x[i + 1] * (A)y[i + 1]; \
+    s2 += (A)x[i + 2] * (A)y[i + 2]; s3 += (A)x[i + 3] * (A)y[i + 3]; \
+  } \
+  for (; i < n; i++) s0 += (A)x[i] * (A)y[i]; \
+  return (s0 + s1) + (s2 + s3); \
+} \
+static lua_Integer firstnum_##N (const T *x, lua_Integer n) { \
+  lua_Integer i = 0; \
+  while (i < n && x[i] != x[i]) i++;  /* skip NaNs */ \
+  return i; \
+} \
+static T min_##N (const T *x, lua_Integer n) {  /* n > 0 */ \
+  lua_Integer i = firstnum_##N(x, n); \
+  T m0, m1, m2, m3; \
+  if (i == n) return x[0];  /* all NaN */ \
+  x += i; n -= i; \
+  m0 = m1 = m2 = m3 = x[0]; \
+  for (i = 0; i + 4 <= n; i += 4) { \
+    if (x[i] < m0) m0 = x[i]; \
+    if (x[i + 1] < m1) m1 = x[i + 1]; \
+    if (x[i + 2] < m2) m2 = x[i + 2]; \
+    if (x[i + 3] < m3) m3 = x[i + 3]; \
+  } \
+  for (; i < n; i++) if (x[i] < m0) m0 = x[i]; \
+  if (m1 < m0) m0 = m1; \
+  if (m3 < m2) m2 = m3; \
+  return (m2 < m0) ? m2 : m0; \
+} \
+static T max_##N (const T *x, lua_Integer n) {  /* n > 0 */ \
+  lua_Integer i = firstnum_##N(x, n); \
+  T m0, m1, m2, m3; \
+  if (i == n) return x[0];  /* all NaN */ \
+  x += i; n -= i; \
+  m0 = m1 = m2 = m3 = x[0]; \
+  for (i = 0; i + 4 <= n; i += 4) { \
+    if (x[i] > m0) m0 = x[i]; \
+    if (x[i + 1] > m1) m1 = x[i + 1]; \
+    if (x[i + 2] > m2) m2 = x[i + 2]; \
+    if (x[i + 3] > m3) m3 = x[i + 3]; \
+  } \
+  for (; i < n; i++) if (x[i] > m0) m0 = x[i]; \
+  if (m1 > m0) m0 = m1; \
+  if (m3 > m2) m2 = m3; \
+  return (m2 > m0) ? m2 : m0; \
+} \
+static void scale_##N (T *x, A k, lua_Integer n) { \
+  lua_Integer i; \
+  for (i = 0; i < n; i++) x[i] = (T)((A)x[i] * k); \
+} \
+static void addk_##N (T *x, A k, lua_Integer n) { \
+  lua_Integer i; \
+  for (i = 0; i < n; i++) x[i] = (T)((A)x[i] + k); \
+} \
+static void addv_##N (T *x, const T *y, lua_Integer n) { \
+  lua_Integer i; \
+  for (i = 0; i < n; i++) x[i] = (T)((A)x[i] + (A)y[i]); \
+} \
+static void cumsum_##N (T *x, lua_Integer n) { \
+  A s = 0; \
+  lua_Integer i; \
+  for (i = 0; i < n; i++) x[i] = (T)(s += (A)x[i]); \
+} \
+static int cmp_##N (const void *pa, const void *pb) {  /* NaNs go last */ \
+  T a = *(const T *)pa, b = *(const T *)pb; \
+  if (a < b || (b != b && a == a)) return -1; \
+  else if (b < a || (a != a && b == b)) return 1; \
+  else return 0; \
+}
+
+DEFKERNELS(f64, double, double)
+DEFKERNELS(i64, lua_Integer, lua_Unsigned)
+DEFKERNELS(f32, float, double)
+
+/* }====================================================== */
+
+
+static int arr_new (lua_State *L) {
+  int type = luaL_checkoption(L, 1, NULL, typenames);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  NumArray *a;
+  lua_settop(L, 3);
+  a = newarray(L, type, n);
+  if (!lua_isnil(L, 3)) {  /* fill value? */
+    lua_Integer i;
+    if (n > 0) setelem(L, a, 0, 3);
+    for (i = 1; i < n; i++) {
+      switch (type) {
+        case AFLOAT64: a->u.f64[i] = a->u.f64[0]; break;
+        case AINT64: a->u.i64[i] = a->u.i64[0]; break;
+        default: a->u.f32[i] = a->u.f32[0]; break;
+      }
+    }
+  }
+  return 1;
+}
+
+
+/*
+** array.fromtable(type, t [, i [, j]]): array with 't[i..j]'
+*/
+static int arr_fromtable (lua_State *L) {
+  int type = luaL_checkoption(L, 1, NULL, typenames);
+  lua_Integer i, j, k;
+  NumArray *a;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  i = luaL_optinteger(L, 3, 1);
+  j = luaL_opt(L, luaL_checkinteger, 4, (lua_Integer)lua_rawlen(L, 2));
+  luaL_argcheck(L, i > j || (lua_Unsigned)j - (lua_Unsigned)i < INT_MAX,
+                   4, "range too large");
+  a = newarray(L, type, (i > j) ? 0 : j - i + 1);
+  for (k = 0; k < a->n; k += CHUNK) {
+    int m = (a->n - k < CHUNK) ? (int)(a->n - k) : CHUNK;
+    int got;
+    if (type == AINT64)
+      got = lua_rawgetiarray(L, 2, i + k, m, a->u.i64 + k);
+    else {
+      lua_Number buff[CHUNK];
+      int l;
+      got = lua_rawgetarray(L, 2, i + k, m, buff);
+      for (l = 0; l < got; l++) {
+        if (type == AFLOAT64) a->u.f64[k + l] = (double)buff[l];
+        else a->u.f32[k + l] = (float)buff[l];
+      }
+    }
+    if (got < m)
+      return luaL_error(L, "element %I of table is not a%s number",
+                        (LUAI_UACINT)(i + k + got),
+                        (type == AINT64) ? "n integer" : "");
+  }
+  return 1;
+}
+
+
+/*
+** a:totable(): new table with the elements of 'a'
+*/
+static int arr_totable (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_Integer k;
+  luaL_argcheck(L, a->n < INT_MAX, 1, "array too large");
+  lua_createtable(L, (int)a->n, 0);
+  for (k = 0; k < a->n; k += CHUNK) {
+    int m = (a->n - k < CHUNK) ? (int)(a->n - k) : CHUNK;
+    if (a->type == AINT64)
+      lua_rawsetiarray(L, -1, k + 1, m, a->u.i64 + k);
+    else {
+      lua_Number buff[CHUNK];
+      int l;
+      for (l = 0; l < m; l++)
+        buff[l] = (a->type == AFLOAT64) ? (lua_Number)a->u.f64[k + l]
+                                        : (lua_Number)a->u.f32[k + l];
+      lua_rawsetarray(L, -1, k + 1, m, buff);
+    }
+  }
+  return 1;
+}
+
+
+static int arr_sum (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  switch (a->type) {
+    case AFLOAT64: lua_pushnumber(L, sum_f64(a->u.f64, a->n)); break;
+    case AINT64:
+      lua_pushinteger(L, (lua_Integer)sum_i64(a->u.i64, a->n));
+      break;
+    default: lua_pushnumber(L, sum_f32(a->u.f32, a->n)); break;
+  }
+  return 1;
+}
+
+
+/* check that argument 'arg' is an array like 'a' */
+static NumArray *checkpeer (lua_State *L, int arg, const NumArray *a) {
+  NumArray *b = checkarray(L, arg);
+  luaL_argcheck(L, b->type == a->type, arg, "arrays of different types");
+  luaL_argcheck(L, b->n == a->n, arg, "arrays of different sizes");
+  return b;
+}
+
+
+static int arr_dot (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  NumArray *b = checkpeer(L, 2, a);
+  switch (a->type) {
+    case AFLOAT64: lua_pushnumber(L, dot_f64(a->u.f64, b->u.f64, a->n)); break;
+    case AINT64:
+      lua_pushinteger(L, (lua_Integer)dot_i64(a->u.i64, b->u.i64, a->n));
+      break;
+    default: lua_pushnumber(L, dot_f32(a->u.f32, b->u.f32, a->n)); break;
+  }
+  return 1;
+}
+
+
+/*
+** a:min(), a:max(): smallest/largest element, ignoring NaNs (NaN only
+** when all elements are NaN); nil for an empty array
+*/
+static int minmax (lua_State *L, int ismax) {
+  NumArray *a = checkarray(L, 1);
+  if (a->n == 0)
+    lua_pushnil(L);
+  else switch (a->type) {
+    case AFLOAT64:
+      lua_pushnumber(L, ismax ? max_f64(a->u.f64, a->n)
+                              : min_f64(a->u.f64, a->n));
+      break;
+    case AINT64:
+      lua_pushinteger(L, ismax ? max_i64(a->u.i64, a->n)
+                               : min_i64(a->u.i64, a->n));
+      break;
+    default:
+      lua_pushnumber(L, ismax ? max_f32(a->u.f32, a->n)
+                              : min_f32(a->u.f32, a->n));
+      break;
+  }
+  return 1;
+}
+
+
+static int arr_min (lua_State *L) {
+  return minmax(L, 0);
+}
+
+
+static int arr_max (lua_State *L) {
+  return minmax(L, 1);
+}
+
+
+/*
+** a:scale(k): multiply all elements by 'k' in place; returns 'a'
+*/
+static int arr_scale (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  switch (a->type) {
+    case AFLOAT64: scale_f64(a->u.f64, luaL_checknumber(L, 2), a->n); break;
+    case AINT64:
+      scale_i64(a->u.i64, (lua_Unsigned)luaL_checkinteger(L, 2), a->n);
+      break;
+    default: scale_f32(a->u.f32, luaL_checknumber(L, 2), a->n); break;
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** a:add(x): add number 'x' or the elements of array 'x' to the
+** elements of 'a' in place; returns 'a'
+*/
+static int arr_add (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    switch (a->type) {
+      case AFLOAT64: addk_f64(a->u.f64, lua_tonumber(L, 2), a->n); break;
+      case AINT64:
+        addk_i64(a->u.i64, (lua_Unsigned)luaL_checkinteger(L, 2), a->n);
+        break;
+      default: addk_f32(a->u.f32, lua_tonumber(L, 2), a->n); break;
+    }
+  }
+  else {
+    NumArray *b = checkpeer(L, 2, a);
+    switch (a->type) {
+      case AFLOAT64: addv_f64(a->u.f64, b->u.f64, a->n); break;
+      case AINT64: addv_i64(a->u.i64, b->u.i64, a->n); break;
+      default: addv_f32(a->u.f32, b->u.f32, a->n); break;
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** a:cumsum(): replace each element by the sum of the elements up to it;
+** returns 'a'
+*/
+static int arr_cumsum (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  switch (a->type) {
+    case AFLOAT64: cumsum_f64(a->u.f64, a->n); break;
+    case AINT64: cumsum_i64(a->u.i64, a->n); break;
+    default: cumsum_f32(a->u.f32, a->n); break;
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** a:sort(): sort elements in ascending order in place (NaNs last);
+** returns 'a'
+*/
+static int arr_sort (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  switch (a->type) {
+    case AFLOAT64: qsort(a->u.f64, (size_t)a->n, sizeof(double), cmp_f64); break;
+    case AINT64:
+      qsort(a->u.i64, (size_t)a->n, sizeof(lua_Integer), cmp_i64);
+      break;
+    default: qsort(a->u.f32, (size_t)a->n, sizeof(float), cmp_f32); break;
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_type (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_pushstring(L, typenames[a->type]);
+  return 1;
+}
+
+
+/*
+** get the 0-based position of index 'arg' in 'a', or -1 if out of range
+*/
+static lua_Integer checkpos (lua_State *L, const NumArray *a, int arg) {
+  lua_Integer i = luaL_checkinteger(L, arg);
+  return (1 <= i && i <= a->n) ? i - 1 : -1;
+}
+
+
+static int arr_index (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    int isint;
+    lua_Integer i = lua_tointegerx(L, 2, &isint);
+    if (!isint || i < 1 || i > a->n)  /* no such element? */
+      lua_pushnil(L);
+    else
+      pushelem(L, a, i - 1);
+  }
+  else {  /* method */
+    lua_settop(L, 2);
+    lua_gettable(L, lua_upvalueindex(1));
+  }
+  return 1;
+}
+
+
+static int arr_newindex (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_Integer i = checkpos(L, a, 2);
+  luaL_argcheck(L, i >= 0, 2, "index out of range");
+  setelem(L, a, i, 3);
+  return 0;
+}
+
+
+static int arr_len (lua_State *L) {
+  lua_pushinteger(L, checkarray(L, 1)->n);
+  return 1;
+}
+
+
+static int arr_tostring (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_pushfstring(L, "%s array: %p", typenames[a->type], (void *)a);
+  return 1;
+}
+
+
+static const luaL_Reg arr_funcs[] = {
+  {"new", arr_new},
+  {"fromtable", arr_fromtable},
+  {NULL, NULL}
+};
+
+
+/* methods for arrays */
+static const luaL_Reg arr_methods[] = {
+  {"totable", arr_totable},
+  {"sum", arr_sum},
+  {"dot", arr_dot},
+  {"min", arr_min},
+  {"max", arr_max},
+  {"scale", arr_scale},
+  {"add", arr_add},
+  {"cumsum", arr_cumsum},
+  {"sort", arr_sort},
+  {"type", arr_type},
+  {NULL, NULL}
+};
+
+
+/* metamethods for arrays ('__index' gets the methods as upvalue) */
+static const luaL_Reg arr_meta[] = {
+  {"__newindex", arr_newindex},
+  {"__len", arr_len},
+  {"__tostring", arr_tostring},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_ARRAYHANDLE);  /* create metatable for arrays */
+  luaL_setfuncs(L, arr_meta, 0);  /* add metamethods to new metatable */
+  luaL_newlib(L, arr_methods);  /* create method table */
+  lua_pushcclosure(L, arr_index, 1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = arr_index */
+  lua_pop(L, 1);  /* pop new metatable */
+}
+
+
+LUAMOD_API int luaopen_array (lua_State *L) {
+  luaL_newlib(L, arr_funcs);
+  createmeta(L);
+  return 1;
+}
+
@@ -706,6 +706,12 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
   int status, readstatus;
   int c;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+  if (mode != NULL && strchr(mode, 'z') != NULL) {
+    /* chunk is read through 'lf.buff', which dies when this call returns */
+    lua_pushfstring(L, "cannot load %s in zero-copy mode",
+                       (filename != NULL) ? filename : "stdin");
+    return LUA_ERRFILE;
+  }
   if (filename == NULL) {
     lua_pushliteral(L, "=stdin");
     lf.f = stdin;
@@ -1030,6 +1036,196 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+/*
+** {======================================================
+** Pooled allocator
+** =======================================================
+*/
+
+/*
+** Blocks up to LUAL_POOLMAXSIZE bytes (strings, tables, small node
+** arrays, closures, upvalues, CallInfos...) come from per-state free
+** lists, one for each size class; each class is a multiple of the
+** maximum alignment. Free lists are refilled by carving slabs of
+** LUAL_POOLSLABSIZE bytes. Slabs are never returned to the system
+** while the state lives; they are all released together when the
+** last block of the state is freed (that is, at the end of 'lua_close').
+** Larger blocks go to 'realloc'/'free'.
+*/
+
+#if !defined(LUAL_POOLMAXSIZE)
+#define LUAL_POOLMAXSIZE	256
+#endif
+
+#if !defined(LUAL_POOLSLABSIZE)
+#define LUAL_POOLSLABSIZE	8192
+#endif
+
+
+/* a free block (also the unit of alignment and size for blocks) */
+typedef union PoolBlock {
+  union PoolBlock *next;  /* next free block in its class */
+  lua_Number n; double u; void *s; lua_Integer i; long l;  /* alignment */
+} PoolBlock;
+
+#define POOLGRAIN	sizeof(PoolBlock)
+
+#define NPOOLCLASSES	((LUAL_POOLMAXSIZE + POOLGRAIN - 1) / POOLGRAIN)
+
+/* size class for a block of size 's' (s > 0 && s <= LUAL_POOLMAXSIZE) */
+#define poolclass(s)	(((s) - 1) / POOLGRAIN)
+
+#define ispooled(s)	((s) - 1 < LUAL_POOLMAXSIZE)  /* 0 < s <= max */
+
+/*
+** Large blocks always get room for a slab link plus a block of the
+** largest class, so any of them can become a slab (see 'pooladopt').
+*/
+#define MINLARGE	((NPOOLCLASSES + 1) * POOLGRAIN)
+#define largesize(s)	((s) < MINLARGE ? MINLARGE : (s))
+
+
+typedef struct Pool {
+  PoolBlock *freeblocks[NPOOLCLASSES];  /* free lists, one per class */
+  PoolBlock *slabs;  /* list of all slabs (linked by their first block) */
+  size_t nblocks;  /* number of live blocks (plus one while building) */
+} Pool;
+
+
+static void freepool (Pool *p) {
+  PoolBlock *s = p->slabs;
+  while (s != NULL) {
+    PoolBlock *next = s->next;
+    free(s);
+    s = next;
+  }
+  free(p);
+}
+
+
+/*
+** Get a block from class 'c', carving a new slab for that class if
+** its free list is empty. The first block of each slab links it
+** into the list of slabs.
+*/
+static void *poolget (Pool *p, size_t c) {
+  PoolBlock *b = p->freeblocks[c];
+  if (b == NULL) {  /* no free blocks? */
+    size_t bsize = c + 1;  /* block size in grains */
+    size_t n = (LUAL_POOLSLABSIZE / POOLGRAIN - 1) / bsize;
+    PoolBlock *s = (PoolBlock *)malloc((1 + n * bsize) * POOLGRAIN);
+    if (s == NULL) return NULL;
+    s->next = p->slabs;
+    p->slabs = s;
+    b = s + 1;
+    while (--n > 0) {  /* link all blocks but the last one */
+      b->next = b + bsize;
+      b += bsize;
+    }
+    b->next = NULL;  /* last block */
+    b = s + 1;
+  }
+  p->freeblocks[c] = b->next;
+  return b;
+}
+
+
+static void poolput (Pool *p, void *block, size_t c) {
+  PoolBlock *b = (PoolBlock *)block;
+  b->next = p->freeblocks[c];
+  p->freeblocks[c] = b;
+}
+
+
+/*
+** Turn large block 'ptr' (with 'osize' bytes) into a slab for class
+** 'c', moving its first 'nsize' bytes into the slab's first block, which
+** is returned. Used when shrinking a large block into a pooled one with
+** no memory for a new slab, as a shrink must not fail.
+*/
+static void *pooladopt (Pool *p, void *ptr, size_t osize, size_t nsize,
+                        size_t c) {
+  size_t bsize = c + 1;  /* block size in grains */
+  size_t n = (largesize(osize) / POOLGRAIN - 1) / bsize;  /* n >= 1 */
+  PoolBlock *s = (PoolBlock *)ptr;
+  PoolBlock *b;
+  memmove(s + 1, ptr, nsize);
+  s->next = p->slabs;
+  p->slabs = s;
+  b = s + 1;
+  while (--n > 0) {  /* other blocks go to the free list */
+    b += bsize;
+    poolput(p, b, c);
+  }
+  return s + 1;
+}
+
+
+static void poolunref (Pool *p) {
+  if (--p->nblocks == 0)  /* no more blocks in use? */
+    freepool(p);  /* release everything */
+}
+
+
+static void *pool_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  void *nb;
+  if (ptr == NULL) {  /* new block? ('osize' is a type tag) */
+    if (nsize == 0) return NULL;
+    nb = ispooled(nsize) ? poolget(p, poolclass(nsize))
+                         : malloc(largesize(nsize));
+    if (nb != NULL) p->nblocks++;
+    return nb;
+  }
+  else if (nsize == 0) {  /* free block */
+    if (ispooled(osize)) poolput(p, ptr, poolclass(osize));
+    else free(ptr);
+    poolunref(p);
+    return NULL;
+  }
+  else if (ispooled(osize)) {
+    if (ispooled(nsize) && poolclass(nsize) <= poolclass(osize))
+      return ptr;  /* fits in current block; will be freed in a smaller class */
+    nb = ispooled(nsize) ? poolget(p, poolclass(nsize))
+                         : malloc(largesize(nsize));
+    if (nb == NULL) return NULL;
+    memcpy(nb, ptr, osize);  /* growing: osize < nsize */
+    poolput(p, ptr, poolclass(osize));
+    return nb;
+  }
+  else if (!ispooled(nsize))  /* both sizes are large? */
+    return realloc(ptr, largesize(nsize));
+  else {  /* shrink a large block into a pooled one */
+    nb = poolget(p, poolclass(nsize));
+    if (nb == NULL)  /* no memory for a new slab? */
+      return pooladopt(p, ptr, osize, nsize, poolclass(nsize));
+    memcpy(nb, ptr, nsize);
+    free(ptr);
+    return nb;
+  }
+}
+
+
+/*
+** Create a new state whose memory comes from its own pool (see above).
+** Like 'luaL_newstate', but only for states used by one thread at a time
+** (together with their coroutines).
+*/
+LUALIB_API lua_State *luaL_newpooledstate (void) {
+  lua_State *L;
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(Pool));
+  p->nblocks = 1;  /* keep pool alive while building the state */
+  L = lua_newstate(pool_alloc, p);
+  if (L) lua_atpanic(L, &panic);
+  poolunref(p);  /* if state was not created, release pool */
+  return L;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   const lua_Number *v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
@@ -76,7 +76,9 @@ static void swapextra (lua_State *L) {
 ** get arbitrary values (causes at most one wrong hook call). 'hookmask'
 ** is an atomic value. We assume that pointers are atomic too (e.g., gcc
 ** ensures that for all platforms where it runs). Moreover, 'hook' is
-** always checked before being called (see 'luaD_hook').
+** always checked before being called (see 'luaD_hook'). A running
+** 'luaV_execute' notices a new line or count hook at its next call,
+** return, or jump (see 'execfast').
 */
 LUA_API void lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
   if (func == NULL || mask == 0) {  /* turn off hooks? */
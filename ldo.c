@@ -198,11 +198,14 @@ void luaD_growstack (lua_State *L, int n) {
     if (newsize > LUAI_MAXSTACK) newsize = LUAI_MAXSTACK;
     if (newsize < needed) newsize = needed;
     if (newsize > LUAI_MAXSTACK) {  /* stack overflow? */
+      L->stackpeak = 0;  /* runaway demand: do not keep the stack big */
       luaD_reallocstack(L, ERRORSTACKSIZE);
       luaG_runerror(L, "stack overflow");
     }
-    else
+    else {
+      L->stackpeak = needed;  /* remember demand for 'luaD_shrinkstack' */
       luaD_reallocstack(L, newsize);
+    }
   }
 }
 
@@ -218,19 +221,36 @@ static int stackinuse (lua_State *L) {
 }
 
 
+/*
+** Shrink the stack only when it is more than three times the part in
+** use, and then to twice that part (but never below the thread's hint).
+** The sizes also count the demand seen by the last growth, which fades
+** by a quarter at each call (the overflow test uses only the real part
+** in use, as that demand may reach LUAI_MAXSTACK); so, a thread that
+** keeps going deep between collections does not pay a reallocation
+** plus 'correctstack' to shrink its stack in each collection and
+** another to grow it back.
+*/
 void luaD_shrinkstack (lua_State *L) {
   int inuse = stackinuse(L);
-  int goodsize = inuse + (inuse / 8) + 2*EXTRA_STACK;
-  if (goodsize > LUAI_MAXSTACK)
-    goodsize = LUAI_MAXSTACK;  /* respect stack limit */
+  int demand = (inuse < L->stackpeak) ? L->stackpeak : inuse;
+  int max;
+  int goodsize;
+  L->stackpeak -= L->stackpeak / 4;  /* let old demand fade */
+  max = (demand > LUAI_MAXSTACK / 3) ? LUAI_MAXSTACK : 3 * demand;
+  goodsize = (demand > LUAI_MAXSTACK / 2) ? LUAI_MAXSTACK : 2 * demand;
+  if (goodsize < BASIC_STACK_SIZE)
+    goodsize = BASIC_STACK_SIZE;
+  if (goodsize < L->stackhint)
+    goodsize = L->stackhint;
   if (L->stacksize > LUAI_MAXSTACK)  /* had been handling stack overflow? */
     luaE_freeCI(L);  /* free all CIs (list grew because of an error) */
   else
     luaE_shrinkCI(L);  /* shrink list */
-  /* if thread is currently not handling a stack overflow and its
-     good size is smaller than current size, shrink its stack */
+  /* if thread is currently not handling a stack overflow and it is
+     much larger than needed, shrink its stack */
   if (inuse <= (LUAI_MAXSTACK - EXTRA_STACK) &&
-      goodsize < L->stacksize)
+      L->stacksize > max && L->stacksize > goodsize)
     luaD_reallocstack(L, goodsize);
   else  /* don't change stack */
     condmovestack(L,{},{});  /* (change only for debugging) */
@@ -763,13 +783,22 @@ static void checkmode (lua_State *L, const char *mode, const char *x) {
 }
 
 
+/*
+** A 'z' in the mode lets binary chunks keep pointers into the reader's
+** buffer (see 'luaU_undump'); the caller must keep that buffer alive
+** and unchanged for as long as any function loaded from it exists.
+** So 'z' is only valid with readers whose buffers outlive the loaded
+** prototypes (e.g. 'luaL_loadbufferx' over a persistent block), never
+** with readers that reuse a local buffer (as 'luaL_loadfilex' does).
+*/
 static void f_parser (lua_State *L, void *ud) {
   LClosure *cl;
   struct SParser *p = cast(struct SParser *, ud);
   int c = zgetc(p->z);  /* read first character */
   if (c == LUA_SIGNATURE[0]) {
     checkmode(L, p->mode, "binary");
-    cl = luaU_undump(L, p->z, p->name);
+    cl = luaU_undump(L, p->z, p->name,
+                     p->mode != NULL && strchr(p->mode, 'z') != NULL);
   }
   else {
     checkmode(L, p->mode, "text");
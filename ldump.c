@@ -24,6 +24,8 @@ typedef struct {
   lua_Writer writer;
   void *data;
   int strip;
+  int align;  /* true to pad vectors to their natural alignment */
+  size_t offset;  /* bytes written so far */
   int status;
 } DumpState;
 
@@ -42,6 +44,7 @@ static void DumpBlock (const void *b, size_t size, DumpState *D) {
     lua_unlock(D->L);
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
+    D->offset += size;
   }
 }
 
@@ -60,6 +63,19 @@ static void DumpInt (int x, DumpState *D) {
 }
 
 
+/*
+** In aligned dumps, pad with zeros so that the next vector starts at an
+** offset that is a multiple of 'align', letting zero-copy loads use it
+** in place (see 'LoadAlign' in lundump.c)
+*/
+static void DumpAlign (size_t align, DumpState *D) {
+  if (D->align) {
+    while (D->offset % align != 0 && D->status == 0)
+      DumpByte(0, D);
+  }
+}
+
+
 static void DumpNumber (lua_Number x, DumpState *D) {
   DumpVar(x, D);
 }
@@ -89,6 +105,7 @@ static void DumpString (const TString *s, DumpState *D) {
 
 static void DumpCode (const Proto *f, DumpState *D) {
   DumpInt(f->sizecode, D);
+  DumpAlign(sizeof(Instruction), D);
   DumpVector(f->code, f->sizecode, D);
 }
 
@@ -148,6 +165,7 @@ static void DumpDebug (const Proto *f, DumpState *D) {
   int i, n;
   n = (D->strip) ? 0 : f->sizelineinfo;
   DumpInt(n, D);
+  DumpAlign(sizeof(int), D);
   DumpVector(f->lineinfo, n, D);
   n = (D->strip) ? 0 : f->sizelocvars;
   DumpInt(n, D);
@@ -184,7 +202,7 @@ static void DumpFunction (const Proto *f, TString *psource, DumpState *D) {
 static void DumpHeader (DumpState *D) {
   DumpLiteral(LUA_SIGNATURE, D);
   DumpByte(LUAC_VERSION, D);
-  DumpByte(LUAC_FORMAT, D);
+  DumpByte(D->align ? LUAC_FORMATALIGNED : LUAC_FORMAT, D);
   DumpLiteral(LUAC_DATA, D);
   DumpByte(sizeof(int), D);
   DumpByte(sizeof(size_t), D);
@@ -197,15 +215,18 @@ static void DumpHeader (DumpState *D) {
 
 
 /*
-** dump Lua function as precompiled chunk
+** dump Lua function as precompiled chunk; 'align' selects the aligned
+** format, whose code and line information can be loaded without copies
 */
 int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
-              int strip) {
+              int strip, int align) {
   DumpState D;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
+  D.align = align;
+  D.offset = 0;
   D.status = 0;
   DumpHeader(&D);
   DumpByte(f->sizeupvalues, &D);
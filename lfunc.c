@@ -105,6 +105,7 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->icache = NULL;
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -113,26 +114,71 @@ Proto *luaF_newproto (lua_State *L) {
   f->numparams = 0;
   f->is_vararg = 0;
   f->maxstacksize = 0;
+  f->fixed = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+  f->shared = NULL;
   return f;
 }
 
 
+/*
+** create the inline caches for the (final) code of prototype 'f'; see
+** 'luaH_getshortstrcached'
+*/
+void luaF_initicache (lua_State *L, Proto *f) {
+  int i;
+  f->icache = luaM_newvector(L, f->sizecode, unsigned int);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode);
+  if (!(f->fixed & FIXEDCODE))
+    luaM_freearray(L, f->code, f->sizecode);
+  luaM_freearray(L, f->icache, f->sizecode);  /* (may be NULL) */
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+  if (!(f->fixed & FIXEDLINES))
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  if (f->shared != NULL)
+    luaF_releaseshared(f->shared);
   luaM_free(L, f);
 }
 
 
+/*
+** Make every prototype in tree 'f' that borrows vectors from the image
+** of 'sp' hold a reference to it
+*/
+void luaF_anchorshared (Proto *f, lua_SharedProto *sp) {
+  int i;
+  if (f->fixed && f->shared == NULL) {
+    luai_refinc(sp->nref);
+    f->shared = sp;
+  }
+  for (i = 0; i < f->sizep; i++)
+    luaF_anchorshared(f->p[i], sp);
+}
+
+
+/*
+** Drop a reference to a shared prototype; the last one frees it. This
+** can run in any state, so the block goes back to the allocator that
+** created it.
+*/
+void luaF_releaseshared (lua_SharedProto *sp) {
+  if (luai_refdec(sp->nref) == 0)
+    (*sp->frealloc)(sp->ud, sp, sizeof(USharedProto) + sp->size, 0);
+}
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
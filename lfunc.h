@@ -47,13 +47,38 @@ struct UpVal {
 #define upisopen(up)	((up)->v != &(up)->u.value)
 
 
+/*
+** A prototype tree frozen for use by several global states: an image
+** of the tree in the aligned dump format, which states load in place
+** (see 'lua_loadshared'). Each prototype borrowing from the image holds
+** a reference to it, as does the creator until 'lua_releaseshared'.
+*/
+struct lua_SharedProto {
+  unsigned int nref;  /* reference counter */
+  lua_Alloc frealloc;  /* function that allocated this block */
+  void *ud;  /* auxiliary data to 'frealloc' */
+  size_t size;  /* size of the image */
+};
+
+typedef union USharedProto {
+  L_Umaxalign dummy;  /* ensures maximum alignment for the image */
+  struct lua_SharedProto sp;
+} USharedProto;
+
+/* get the image of a shared prototype */
+#define getimage(sp)	(cast(char *, (sp)) + sizeof(USharedProto))
+
+
 LUAI_FUNC Proto *luaF_newproto (lua_State *L);
 LUAI_FUNC CClosure *luaF_newCclosure (lua_State *L, int nelems);
 LUAI_FUNC LClosure *luaF_newLclosure (lua_State *L, int nelems);
 LUAI_FUNC void luaF_initupvals (lua_State *L, LClosure *cl);
 LUAI_FUNC UpVal *luaF_findupval (lua_State *L, StkId level);
 LUAI_FUNC void luaF_close (lua_State *L, StkId level);
+LUAI_FUNC void luaF_initicache (lua_State *L, Proto *f);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
+LUAI_FUNC void luaF_anchorshared (Proto *f, lua_SharedProto *sp);
+LUAI_FUNC void luaF_releaseshared (lua_SharedProto *sp);
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
 
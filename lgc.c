@@ -44,6 +44,9 @@
 /* cost of calling one finalizer */
 #define GCFINALIZECOST	GCSWEEPCOST
 
+/* maximum number of string-table buckets rehashed in each step */
+#define GCREHASHMAX	64
+
 
 /*
 ** macro to adjust 'stepmul': 'stepmul' is actually used like
@@ -60,10 +63,10 @@
 
 
 /*
-** 'makewhite' erases all color bits then sets only the current white
-** bit
+** 'makewhite' erases all color bits (and the old bit) then sets only
+** the current white bit
 */
-#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS))
+#define maskcolors	(~(bit2mask(BLACKBIT, OLDBIT) | WHITEBITS))
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
@@ -93,6 +96,10 @@
 
 static void reallymarkobject (global_State *g, GCObject *o);
 
+#if defined(LUA_USE_PARALLELGC)
+static void parallelpropagate (global_State *g);
+#endif
+
 
 /*
 ** {======================================================
@@ -176,6 +183,20 @@ void luaC_barrierback_ (lua_State *L, Table *t) {
 }
 
 
+/*
+** barrier for the closure cache of an old prototype in generational
+** mode (old objects stay black between collections): make it gray
+** again, so that the next collection retraverses it and clears the
+** cache if the closure dies.
+*/
+void luaC_protobarrier_ (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  lua_assert(isblack(p) && isgenerational(g) && keepinvariant(g));
+  black2gray(p);  /* make prototype gray (again) */
+  linkgclist(p, g->grayagain);
+}
+
+
 /*
 ** barrier for assignments to closed upvalues. Because upvalues are
 ** shared among closures, it is impossible to know the color of all
@@ -378,6 +399,8 @@ static void traverseweakvalue (global_State *g, Table *h) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else if (isgenerational(g))
+    linkgclist(h, g->grayagain);  /* must retraverse it in next cycle */
 }
 
 
@@ -426,6 +449,8 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else if (isgenerational(g))
+    linkgclist(h, g->grayagain);  /* must retraverse it in next cycle */
   return marked;
 }
 
@@ -448,6 +473,19 @@ static void traversestrongtable (global_State *g, Table *h) {
 }
 
 
+/* memory used by a table and by a prototype, as counted by the traversal */
+#define sizetable(h)	(sizeof(Table) + sizeof(TValue) * (h)->sizearray + \
+                         sizeof(Node) * cast(size_t, allocsizenode(h)))
+
+#define sizeproto(f)	(sizeof(Proto) + sizeof(Instruction) * (f)->sizecode + \
+                         sizeof(unsigned int) * (f)->sizecode +  /* icache */ \
+                         sizeof(Proto *) * (f)->sizep + \
+                         sizeof(TValue) * (f)->sizek + \
+                         sizeof(int) * (f)->sizelineinfo + \
+                         sizeof(LocVar) * (f)->sizelocvars + \
+                         sizeof(Upvaldesc) * (f)->sizeupvalues)
+
+
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
@@ -466,8 +504,7 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, allocsizenode(h));
+  return sizetable(h);
 }
 
 
@@ -489,12 +526,7 @@ static int traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
-  return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
-                         sizeof(Proto *) * f->sizep +
-                         sizeof(TValue) * f->sizek +
-                         sizeof(int) * f->sizelineinfo +
-                         sizeof(LocVar) * f->sizelocvars +
-                         sizeof(Upvaldesc) * f->sizeupvalues;
+  return sizeproto(f);
 }
 
 
@@ -544,6 +576,8 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
       th->twups = g->twups;  /* link it back to the list */
       g->twups = th;
     }
+    if (isgenerational(g))  /* old threads are only traversed here */
+      luaD_shrinkstack(th);
   }
   else if (g->gckind != KGC_EMERGENCY)
     luaD_shrinkstack(th); /* do not change stack in emergency cycle */
@@ -600,7 +634,17 @@ static void propagatemark (global_State *g) {
 }
 
 
+/*
+** Traverse all gray objects. This is only called while the program
+** is stopped, so helper threads may do the work.
+*/
 static void propagateall (global_State *g) {
+#if defined(LUA_USE_PARALLELGC)
+  if (g->parmark != NULL) {
+    parallelpropagate(g);
+    return;
+  }
+#endif
   while (g->gray) propagatemark(g);
 }
 
@@ -625,6 +669,645 @@ static void convergeephemerons (global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+#if defined(LUA_USE_PARALLELGC)
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+
+/*
+** While the program is stopped, 'propagateall' can share its work with
+** helper threads. Each worker (the collector itself is worker 0) keeps
+** a private list of gray objects; when some worker is idle, the others
+** offer it part of their lists through their 'shared' slots, which any
+** worker may steal. Objects are claimed by clearing their white bits
+** with an atomic operation, so each one is traversed exactly once.
+** Workers only traverse objects whose traversal changes nothing but the
+** object itself: threads and tables that may be weak are left to
+** 'propagatemark', after the workers finish.
+*/
+
+/* number of objects traversed serially before calling the helpers */
+#define PARSERIALSTEPS	1000
+
+/* number of traversals between checks for idle workers */
+#define PAROFFERSTEP	32
+
+
+typedef struct GCWorker {
+  GCObject *gray;  /* private list of gray objects */
+  GCObject *shared;  /* gray objects offered to other workers */
+  GCObject *deferred;  /* gray objects left to 'propagatemark' */
+  lu_mem memtrav;  /* memory traversed by this worker */
+  struct ParMark *pm;
+  pthread_t thread;
+} GCWorker;
+
+
+typedef struct ParMark {
+  global_State *g;
+  pthread_mutex_t mutex;
+  pthread_cond_t start;  /* signals a new round (or 'quit') */
+  pthread_cond_t done;  /* signals that all helpers finished a round */
+  unsigned int round;  /* number of current round */
+  int busy;  /* number of helpers still working in current round */
+  int idle;  /* number of workers without work */
+  int quit;  /* true when helpers must exit */
+  int nw;  /* number of workers (helpers + 1) */
+  int size;  /* size of array 'w' */
+  GCWorker w[1];  /* 'nw' workers; w[0] is the collector */
+} ParMark;
+
+
+#define sizeparmark(n)	(offsetof(ParMark, w) + (n) * sizeof(GCWorker))
+
+#define loadmarked(o)	__atomic_load_n(&(o)->marked, __ATOMIC_RELAXED)
+#define pariswhite(o)	testbits(loadmarked(o), WHITEBITS)
+#define parblacken(o)  \
+  ((void)__atomic_fetch_or(&(o)->marked, bitmask(BLACKBIT), __ATOMIC_RELAXED))
+
+
+static GCObject **gclistof (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: return &gco2t(o)->gclist;
+    case LUA_TLCL: return &gco2lcl(o)->gclist;
+    case LUA_TCCL: return &gco2ccl(o)->gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+#define parlink(o,l)	(*gclistof(o) = (l), (l) = (o))
+
+
+/*
+** Worker version of 'reallymarkobject': 'o' is marked only if this
+** worker is the one that turns it from white to gray.
+*/
+static void parmarkobject (global_State *g, GCWorker *w, GCObject *o) {
+ reentry: {
+  lu_byte m = loadmarked(o);
+  do {
+    if (!testbits(m, WHITEBITS))
+      return;  /* already marked by some worker */
+  } while (!__atomic_compare_exchange_n(&o->marked, &m,
+                                        cast_byte(m & ~WHITEBITS), 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  }
+  switch (o->tt) {
+    case LUA_TSHRSTR: {
+      parblacken(o);
+      w->memtrav += sizelstring(gco2ts(o)->shrlen);
+      break;
+    }
+    case LUA_TLNGSTR: {
+      parblacken(o);
+      w->memtrav += sizelstring(gco2ts(o)->u.lnglen);
+      break;
+    }
+    case LUA_TUSERDATA: {
+      TValue uvalue;
+      if (gco2u(o)->metatable)
+        parmarkobject(g, w, obj2gco(gco2u(o)->metatable));
+      parblacken(o);
+      w->memtrav += sizeudata(gco2u(o));
+      getuservalue(g->mainthread, gco2u(o), &uvalue);
+      if (iscollectable(&uvalue)) {
+        o = gcvalue(&uvalue);
+        goto reentry;
+      }
+      break;
+    }
+    default: {
+      parlink(o, w->gray);
+      break;
+    }
+  }
+}
+
+
+#define parmarkvalue(g,w,o)  \
+  { if (iscollectable(o)) parmarkobject(g, w, gcvalue(o)); }
+
+#define parmarkobjectN(g,w,t)  \
+  { if (t) parmarkobject(g, w, obj2gco(t)); }
+
+
+/*
+** Traverse a table that cannot be weak (its metatable is known to have
+** no '__mode' field); 'traversestrongtable' run by a worker.
+*/
+static void partraversetable (global_State *g, GCWorker *w, Table *h) {
+  Node *n, *limit = gnodelast(h);
+  unsigned int i;
+  parmarkobjectN(g, w, h->metatable);
+  for (i = 0; i < h->sizearray; i++)  /* traverse array part */
+    parmarkvalue(g, w, &h->array[i]);
+  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+    checkdeadkey(n);
+    if (ttisnil(gval(n))) {  /* entry is empty? */
+      if (iscollectable(gkey(n)) && pariswhite(gcvalue(gkey(n))))
+        setdeadvalue(wgkey(n));  /* remove it ('removeentry') */
+    }
+    else {
+      lua_assert(!ttisnil(gkey(n)));
+      parmarkvalue(g, w, gkey(n));  /* mark key */
+      parmarkvalue(g, w, gval(n));  /* mark value */
+    }
+  }
+  w->memtrav += sizetable(h);
+}
+
+
+static void partraverseproto (global_State *g, GCWorker *w, Proto *f) {
+  int i;
+  if (f->cache && pariswhite(f->cache))
+    f->cache = NULL;  /* allow cache to be collected */
+  parmarkobjectN(g, w, f->source);
+  for (i = 0; i < f->sizek; i++)  /* mark literals */
+    parmarkvalue(g, w, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++)  /* mark upvalue names */
+    parmarkobjectN(g, w, f->upvalues[i].name);
+  for (i = 0; i < f->sizep; i++)  /* mark nested protos */
+    parmarkobjectN(g, w, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
+    parmarkobjectN(g, w, f->locvars[i].varname);
+  w->memtrav += sizeproto(f);
+}
+
+
+static void partraverseLclosure (global_State *g, GCWorker *w,
+                                 LClosure *cl) {
+  int i;
+  parmarkobjectN(g, w, cl->p);  /* mark its prototype */
+  for (i = 0; i < cl->nupvalues; i++) {  /* mark its upvalues */
+    UpVal *uv = cl->upvals[i];
+    if (uv != NULL) {
+      if (upisopen(uv) && g->gcstate != GCSinsideatomic)  /* shared flag */
+        __atomic_store_n(&uv->u.open.touched, 1, __ATOMIC_RELAXED);
+      else
+        parmarkvalue(g, w, uv->v);
+    }
+  }
+  w->memtrav += sizeLclosure(cl->nupvalues);
+}
+
+
+/*
+** Traverse gray object 'o' (claimed by this worker), or defer it to
+** 'propagatemark'. (A table whose metatable has no cached absence of
+** '__mode' may be weak; checking it would change the metatable.)
+*/
+static void partraverse (global_State *g, GCWorker *w, GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: {
+      Table *mt = gco2t(o)->metatable;
+      if (mt != NULL && !testbit(mt->flags, TM_MODE)) {
+        parlink(o, w->deferred);
+        return;
+      }
+      partraversetable(g, w, gco2t(o));
+      break;
+    }
+    case LUA_TLCL: partraverseLclosure(g, w, gco2lcl(o)); break;
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      for (i = 0; i < cl->nupvalues; i++)  /* mark its upvalues */
+        parmarkvalue(g, w, &cl->upvalue[i]);
+      w->memtrav += sizeCclosure(cl->nupvalues);
+      break;
+    }
+    case LUA_TPROTO: partraverseproto(g, w, gco2p(o)); break;
+    default: {  /* threads */
+      parlink(o, w->deferred);
+      return;
+    }
+  }
+  parblacken(o);
+}
+
+
+/*
+** If some worker is idle and 'w' has spare work (and no pending offer),
+** offer all its gray objects but the first one.
+*/
+static void offerwork (ParMark *pm, GCWorker *w) {
+  if (__atomic_load_n(&pm->idle, __ATOMIC_RELAXED) > 0 &&
+      __atomic_load_n(&w->shared, __ATOMIC_RELAXED) == NULL) {
+    GCObject **next = gclistof(w->gray);
+    GCObject *rest = *next;
+    if (rest != NULL) {
+      *next = NULL;
+      __atomic_store_n(&w->shared, rest, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+
+/*
+** Take some offered work, starting with the one 'w' offered itself.
+*/
+static int getwork (ParMark *pm, GCWorker *w) {
+  int me = cast_int(w - pm->w);
+  int i;
+  for (i = 0; i < pm->nw; i++) {
+    GCWorker *v = &pm->w[(me + i) % pm->nw];
+    if (__atomic_load_n(&v->shared, __ATOMIC_RELAXED) != NULL) {
+      GCObject *l = __atomic_exchange_n(&v->shared, NULL, __ATOMIC_ACQUIRE);
+      if (l != NULL) {
+        w->gray = l;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+
+static int hasoffers (ParMark *pm) {
+  int i;
+  for (i = 0; i < pm->nw; i++) {
+    if (__atomic_load_n(&pm->w[i].shared, __ATOMIC_RELAXED) != NULL)
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Main loop of a worker. A worker becomes idle only after taking back
+** its own offer, and only non-idle workers make offers; so, when all
+** workers are idle, there is no work left anywhere.
+*/
+static void workermark (ParMark *pm, GCWorker *w) {
+  global_State *g = pm->g;
+  for (;;) {
+    GCObject *o;
+    unsigned int count = 0;
+    while ((o = w->gray) != NULL) {
+      w->gray = *gclistof(o);
+      partraverse(g, w, o);
+      if (++count % PAROFFERSTEP == 0 && w->gray != NULL)
+        offerwork(pm, w);
+    }
+    if (getwork(pm, w))
+      continue;
+    __atomic_add_fetch(&pm->idle, 1, __ATOMIC_SEQ_CST);
+    for (;;) {  /* wait for work or for the end of the marking */
+      if (__atomic_load_n(&pm->idle, __ATOMIC_SEQ_CST) == pm->nw)
+        return;  /* everybody is idle */
+      if (hasoffers(pm)) {
+        __atomic_sub_fetch(&pm->idle, 1, __ATOMIC_SEQ_CST);
+        if (getwork(pm, w))
+          break;
+        __atomic_add_fetch(&pm->idle, 1, __ATOMIC_SEQ_CST);
+      }
+      sched_yield();
+    }
+  }
+}
+
+
+static void *helpermain (void *ud) {
+  GCWorker *w = cast(GCWorker *, ud);
+  ParMark *pm = w->pm;
+  unsigned int round = 0;
+  pthread_mutex_lock(&pm->mutex);
+  for (;;) {
+    while (pm->round == round && !pm->quit)
+      pthread_cond_wait(&pm->start, &pm->mutex);
+    if (pm->quit) break;
+    round = pm->round;
+    pthread_mutex_unlock(&pm->mutex);
+    workermark(pm, w);
+    pthread_mutex_lock(&pm->mutex);
+    if (--pm->busy == 0)
+      pthread_cond_signal(&pm->done);
+  }
+  pthread_mutex_unlock(&pm->mutex);
+  return NULL;
+}
+
+
+/*
+** Traverse all gray objects with the helpers. Small markings (common
+** in atomic phases) are done serially. Objects deferred by the workers
+** are traversed by 'propagatemark', which may produce more gray
+** objects for another round.
+*/
+static void parallelpropagate (global_State *g) {
+  ParMark *pm = g->parmark;
+  int steps = PARSERIALSTEPS;
+  while (g->gray && steps-- > 0)
+    propagatemark(g);
+  while (g->gray) {
+    int i;
+    for (i = 0; g->gray != NULL; i = (i + 1) % pm->nw) {  /* deal them */
+      GCObject *o = g->gray;
+      g->gray = *gclistof(o);
+      parlink(o, pm->w[i].gray);
+    }
+    pm->idle = 0;
+    pthread_mutex_lock(&pm->mutex);
+    pm->busy = pm->nw - 1;
+    pm->round++;
+    pthread_cond_broadcast(&pm->start);
+    pthread_mutex_unlock(&pm->mutex);
+    workermark(pm, &pm->w[0]);
+    pthread_mutex_lock(&pm->mutex);
+    while (pm->busy > 0)
+      pthread_cond_wait(&pm->done, &pm->mutex);
+    pthread_mutex_unlock(&pm->mutex);
+    for (i = 0; i < pm->nw; i++) {
+      GCWorker *w = &pm->w[i];
+      GCObject *o;
+      lua_assert(w->gray == NULL && w->shared == NULL);
+      g->GCmemtrav += w->memtrav;
+      w->memtrav = 0;
+      while ((o = w->deferred) != NULL) {
+        w->deferred = *gclistof(o);
+        parlink(o, g->gray);
+        propagatemark(g);  /* traverse 'o' */
+      }
+    }
+  }
+}
+
+
+static void stophelpers (lua_State *L, ParMark *pm) {
+  int i;
+  pthread_mutex_lock(&pm->mutex);
+  pm->quit = 1;
+  pthread_cond_broadcast(&pm->start);
+  pthread_mutex_unlock(&pm->mutex);
+  for (i = 1; i < pm->nw; i++)
+    pthread_join(pm->w[i].thread, NULL);
+  pthread_cond_destroy(&pm->done);
+  pthread_cond_destroy(&pm->start);
+  pthread_mutex_destroy(&pm->mutex);
+  luaM_freemem(L, pm, sizeparmark(pm->size));
+}
+
+
+/*
+** Set the number of helper threads for marking; 0 turns parallel
+** marking off. Returns the previous number. (The new helpers are
+** created before the old ones stop; if none can be created, keep the
+** ones already running.)
+*/
+int luaC_setparallel (lua_State *L, int n) {
+  global_State *g = G(L);
+  ParMark *oldpm = g->parmark;
+  ParMark *pm;
+  int old = (oldpm != NULL) ? oldpm->nw - 1 : 0;
+  int i;
+  if (n < 0) n = 0;
+  else if (n > LUAI_MAXGCHELPERS) n = LUAI_MAXGCHELPERS;
+  if (n == old) return old;
+  if (n > 0) {
+    pm = cast(ParMark *, luaM_malloc(L, sizeparmark(n + 1)));
+    memset(pm, 0, sizeparmark(n + 1));
+    pm->g = g;
+    pm->size = n + 1;
+    pthread_mutex_init(&pm->mutex, NULL);
+    pthread_cond_init(&pm->start, NULL);
+    pthread_cond_init(&pm->done, NULL);
+    pm->w[0].pm = pm;
+    for (i = 1; i <= n; i++) {
+      pm->w[i].pm = pm;
+      if (pthread_create(&pm->w[i].thread, NULL, helpermain, &pm->w[i]) != 0)
+        break;
+    }
+    pm->nw = i;  /* number of threads actually created + 1 */
+    if (pm->nw == 1) {  /* no helpers? */
+      stophelpers(L, pm);
+      return old;  /* keep the old ones */
+    }
+  }
+  else
+    pm = NULL;
+  g->parmark = pm;
+  if (oldpm != NULL)
+    stophelpers(L, oldpm);
+  return old;
+}
+
+#else
+
+int luaC_setparallel (lua_State *L, int n) {
+  UNUSED(L); UNUSED(n);
+  return 0;  /* no helpers */
+}
+
+#endif
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Background freeing
+** =======================================================
+*/
+
+#if defined(LUA_USE_PARALLELGC)
+
+/*
+** When enabled (which requires a thread-safe allocator), blocks freed
+** during the sweep phase go to a queue instead of to 'frealloc'; a
+** background thread calls 'frealloc' for them. The memory accounting
+** is done at once, by 'luaM_realloc_'. Each queued block stores its
+** own link and size, so smaller blocks are freed at once.
+*/
+
+/* number of blocks handed at a time to the background thread */
+#define BGFREEBATCH	256
+
+
+typedef struct FreeBlock {
+  struct FreeBlock *next;
+  size_t size;
+} FreeBlock;
+
+
+typedef struct BgFree {
+  lua_Alloc frealloc;
+  void *ud;
+  FreeBlock *batch;  /* blocks not yet handed to the thread */
+  FreeBlock *batchlast;  /* last element of 'batch' */
+  int nbatch;  /* number of blocks in 'batch' */
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;  /* signals new blocks (or 'quit') to the thread */
+  pthread_cond_t drained;  /* signals that the thread freed everything */
+  FreeBlock *pending;  /* blocks handed to the thread */
+  int busy;  /* true while the thread is freeing blocks */
+  int quit;  /* true when the thread must exit */
+  pthread_t thread;
+} BgFree;
+
+
+static void *bgfreemain (void *ud) {
+  BgFree *bf = cast(BgFree *, ud);
+  pthread_mutex_lock(&bf->mutex);
+  for (;;) {
+    FreeBlock *l;
+    while (bf->pending == NULL && !bf->quit)
+      pthread_cond_wait(&bf->wake, &bf->mutex);
+    if (bf->pending == NULL) break;  /* quit with no more work */
+    l = bf->pending;
+    bf->pending = NULL;
+    bf->busy = 1;
+    pthread_mutex_unlock(&bf->mutex);
+    while (l != NULL) {
+      FreeBlock *next = l->next;
+      (*bf->frealloc)(bf->ud, l, l->size, 0);
+      l = next;
+    }
+    pthread_mutex_lock(&bf->mutex);
+    bf->busy = 0;
+    if (bf->pending == NULL)
+      pthread_cond_broadcast(&bf->drained);
+  }
+  pthread_mutex_unlock(&bf->mutex);
+  return NULL;
+}
+
+
+/*
+** hand the current batch to the background thread
+*/
+static void flushfree (global_State *g) {
+  BgFree *bf = g->bgfree;
+  if (bf != NULL && bf->batch != NULL) {
+    pthread_mutex_lock(&bf->mutex);
+    bf->batchlast->next = bf->pending;
+    bf->pending = bf->batch;
+    pthread_cond_signal(&bf->wake);
+    pthread_mutex_unlock(&bf->mutex);
+    bf->batch = bf->batchlast = NULL;
+    bf->nbatch = 0;
+  }
+}
+
+
+/*
+** wait until all queued blocks are really freed
+*/
+static void waitfree (global_State *g) {
+  BgFree *bf = g->bgfree;
+  if (bf != NULL) {
+    flushfree(g);
+    pthread_mutex_lock(&bf->mutex);
+    while (bf->pending != NULL || bf->busy)
+      pthread_cond_wait(&bf->drained, &bf->mutex);
+    pthread_mutex_unlock(&bf->mutex);
+  }
+}
+
+
+/*
+** Called by 'luaM_realloc_' to free a block; returns true if the block
+** was queued. Only sweeps of non-emergency collections queue blocks.
+*/
+int luaC_deferfree (global_State *g, void *block, size_t size) {
+  BgFree *bf = g->bgfree;
+  FreeBlock *b = cast(FreeBlock *, block);
+  if (size < sizeof(FreeBlock) || !issweepphase(g) ||
+      g->gckind == KGC_EMERGENCY)
+    return 0;
+  b->size = size;
+  b->next = bf->batch;
+  if (bf->batch == NULL) bf->batchlast = b;
+  bf->batch = b;
+  if (++bf->nbatch >= BGFREEBATCH)
+    flushfree(g);
+  return 1;
+}
+
+
+/*
+** Called by 'lua_setallocf': blocks already queued are freed with the
+** old allocator (as they would have been without the thread), and the
+** thread uses the new one from then on.
+*/
+void luaC_setbgalloc (global_State *g, lua_Alloc f, void *ud) {
+  BgFree *bf = g->bgfree;
+  if (bf != NULL) {
+    waitfree(g);
+    pthread_mutex_lock(&bf->mutex);
+    bf->frealloc = f;
+    bf->ud = ud;
+    pthread_mutex_unlock(&bf->mutex);
+  }
+}
+
+
+/*
+** Turn background freeing on or off; returns its previous state.
+** (If the thread cannot be created, it stays off.)
+*/
+int luaC_setbgfree (lua_State *L, int on) {
+  global_State *g = G(L);
+  BgFree *bf = g->bgfree;
+  int old = (bf != NULL);
+  if (on == old) return old;
+  if (bf != NULL) {  /* turn it off */
+    flushfree(g);
+    g->bgfree = NULL;
+    pthread_mutex_lock(&bf->mutex);
+    bf->quit = 1;
+    pthread_cond_signal(&bf->wake);
+    pthread_mutex_unlock(&bf->mutex);
+    pthread_join(bf->thread, NULL);  /* thread frees everything first */
+    pthread_cond_destroy(&bf->drained);
+    pthread_cond_destroy(&bf->wake);
+    pthread_mutex_destroy(&bf->mutex);
+    luaM_free(L, bf);
+  }
+  else {  /* turn it on */
+    bf = luaM_new(L, BgFree);
+    memset(bf, 0, sizeof(BgFree));
+    bf->frealloc = g->frealloc;
+    bf->ud = g->ud;
+    pthread_mutex_init(&bf->mutex, NULL);
+    pthread_cond_init(&bf->wake, NULL);
+    pthread_cond_init(&bf->drained, NULL);
+    if (pthread_create(&bf->thread, NULL, bgfreemain, bf) != 0) {
+      pthread_cond_destroy(&bf->drained);
+      pthread_cond_destroy(&bf->wake);
+      pthread_mutex_destroy(&bf->mutex);
+      luaM_free(L, bf);
+      return old;
+    }
+    g->bgfree = bf;
+  }
+  return old;
+}
+
+#else
+
+#define flushfree(g)	((void)0)
+#define waitfree(g)	((void)0)
+
+int luaC_setbgfree (lua_State *L, int on) {
+  UNUSED(L); UNUSED(on);
+  return 0;  /* not available */
+}
+
+#endif
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Sweep Functions
@@ -762,6 +1445,30 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
   return p;
 }
 
+
+/*
+** sweep a list in generational mode: erase dead objects and turn the
+** survivors old, keeping their colors. New objects are always linked
+** at the head of a list, and objects moved to the head of another list
+** lose their old bit, so all young objects come before the first old
+** one, where the sweep stops.
+*/
+static void sweepgen (lua_State *L, GCObject **p) {
+  global_State *g = G(L);
+  int ow = otherwhite(g);
+  GCObject *curr;
+  while ((curr = *p) != NULL && !isold(curr)) {
+    if (isdeadm(ow, curr->marked)) {  /* is 'curr' dead? */
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else {  /* object survived this collection */
+      l_setbit(curr->marked, OLDBIT);
+      p = &curr->next;  /* go to next element */
+    }
+  }
+}
+
 /* }====================================================== */
 
 
@@ -777,10 +1484,12 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 static void checkSizes (lua_State *L, global_State *g) {
   if (g->gckind != KGC_EMERGENCY) {
     l_mem olddebt = g->GCdebt;
-    if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
+    if (g->strt.nuse < g->strt.size / 4 &&  /* string table too big? */
+        !isresizing(&g->strt))  /* (and not already being resized) */
       luaS_resize(L, g->strt.size / 2);  /* shrink it a little */
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
   }
+  luaH_trimcache(L);  /* release table vectors not reused in this cycle */
 }
 
 
@@ -791,6 +1500,7 @@ static GCObject *udata2finalize (global_State *g) {
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
+  resetoldbit(o);  /* object moved to the head of a list (see 'sweepgen') */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
   return o;
@@ -916,6 +1626,7 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
     l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+    resetoldbit(o);  /* object moved to the head of a list */
   }
 }
 
@@ -983,6 +1694,7 @@ static l_mem atomic (lua_State *L) {
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = NULL;  /* will get the objects that stay gray */
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
@@ -1078,6 +1790,7 @@ static lu_mem singlestep (lua_State *L) {
     case GCSswpend: {  /* finish sweeps */
       makewhite(g, g->mainthread);  /* sweep main thread */
       checkSizes(L, g);
+      flushfree(g);  /* hand remaining dead blocks to background thread */
       g->gcstate = GCScallfin;
       return 0;
     }
@@ -1122,6 +1835,148 @@ static l_mem getdebt (global_State *g) {
   }
 }
 
+
+/*
+** {======================================================
+** Generational mode
+** =======================================================
+*/
+
+
+/*
+** After an atomic phase in generational mode, weak tables are in
+** lists 'weak', 'allweak', and 'ephemeron' (or already in 'grayagain').
+** Move them to 'grayagain', so that the next collection traverses
+** them again: they are gray, so barriers do not catch their changes.
+*/
+static void keepweaklists (global_State *g) {
+  GCObject **lists[3];
+  int i;
+  lists[0] = &g->weak; lists[1] = &g->allweak; lists[2] = &g->ephemeron;
+  for (i = 0; i < 3; i++) {
+    GCObject *l = *lists[i];
+    while (l != NULL) {
+      Table *h = gco2t(l);
+      l = h->gclist;
+      linkgclist(h, g->grayagain);
+    }
+    *lists[i] = NULL;
+  }
+}
+
+
+/*
+** Young collection: the collector rests in the propagate phase between
+** collections, with its gray lists holding the objects marked or
+** caught by barriers (plus all threads and weak tables). Propagate
+** them, run the atomic phase, and sweep only the young objects. The
+** roots need not be marked again, as they are old (or are marked by
+** 'atomic').
+*/
+static void youngcollection (lua_State *L, global_State *g) {
+  lua_assert(g->gcstate == GCSpropagate);
+  propagateall(g);  /* traverse objects marked since last collection */
+  atomic(L);
+  keepweaklists(g);
+  g->gcstate = GCSswpallgc;  /* barriers must not mark objects now */
+  sweepgen(L, &g->allgc);
+  sweepgen(L, &g->finobj);
+  sweepgen(L, &g->tobefnz);
+  checkSizes(L, g);
+  flushfree(g);
+  g->gcstate = GCSpropagate;  /* skip restart */
+}
+
+
+/*
+** Enter generational mode. Finish any cycle in progress (which leaves
+** all objects white) and start a new one; as all objects are young,
+** the first young collection is a full one, after which all survivors
+** are old. Set the estimate used to schedule major collections.
+*/
+static void entergen (lua_State *L, global_State *g) {
+  luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  g->gckind = KGC_GEN;
+  youngcollection(L, g);
+  g->GCestimate = gettotalbytes(g);  /* base for next major collection */
+}
+
+
+/*
+** Major collection in generational mode: sweep all objects back to
+** white (and young) in incremental mode, then reenter generational
+** mode. (As white has not changed, the sweep collects nothing.)
+*/
+static void fullgen (lua_State *L, global_State *g) {
+  g->gckind = KGC_NORMAL;
+  entersweep(L);
+  entergen(L, g);
+}
+
+
+/*
+** Set debt for the next young collection, which will happen when
+** memory grows 'genminormul'% over its current size.
+*/
+static void setminordebt (global_State *g) {
+  luaE_setdebt(g, -(cast(l_mem, (gettotalbytes(g) / 100)) * g->genminormul));
+}
+
+
+/*
+** Call all pending finalizers after a generational collection.
+*/
+static void callgenfinalizers (lua_State *L, global_State *g) {
+  while (g->tobefnz)
+    GCTM(L, 1);
+  setminordebt(g);
+}
+
+
+/*
+** A step in generational mode is a whole young collection, unless
+** memory grew more than 'genmajormul'% since the last major
+** collection; in that case, it is a major collection.
+*/
+static void genstep (lua_State *L, global_State *g) {
+  lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
+  lu_mem majorinc = (majorbase / 100) * g->genmajormul;
+  if (gettotalbytes(g) > majorbase + majorinc)
+    fullgen(L, g);
+  else {
+    youngcollection(L, g);
+    g->GCestimate = majorbase;  /* keep base from last major collection */
+  }
+  callgenfinalizers(L, g);
+}
+
+
+/*
+** Change collector mode between incremental (KGC_NORMAL) and
+** generational (KGC_GEN).
+*/
+void luaC_changemode (lua_State *L, int mode) {
+  global_State *g = G(L);
+  if (mode == g->gckind) return;  /* nothing to change */
+  if (mode == KGC_GEN) {  /* change to generational mode */
+    entergen(L, g);
+    callgenfinalizers(L, g);
+  }
+  else {  /* change to incremental mode */
+    /* sweep all objects to turn them back to white
+       (as white has not changed, nothing extra will be collected) */
+    g->gckind = KGC_NORMAL;
+    g->GCestimate = gettotalbytes(g);
+    entersweep(L);
+    luaC_runtilstate(L, bitmask(GCScallfin));
+    setpause(g);
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** performs a basic GC step when collector is running
 */
@@ -1132,6 +1987,11 @@ void luaC_step (lua_State *L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  luaS_rehash(L, GCREHASHMAX);  /* help pending string-table resize */
+  if (isgenerational(g)) {
+    genstep(L, g);
+    return;
+  }
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1153,24 +2013,44 @@ void luaC_step (lua_State *L) {
 ** Before running the collection, check 'keepinvariant'; if it is true,
 ** there may be some objects marked as black, so the collector has
 ** to sweep all objects to turn them back to white (as white has not
-** changed, nothing will be collected).
+** changed, nothing will be collected). In generational mode, a
+** regular full collection is a major collection; an emergency one
+** runs in incremental mode and then leaves all objects young.
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
-  if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+  int origkind = g->gckind;
+  lua_assert(origkind != KGC_EMERGENCY);
+  if (isemergency)
+    waitfree(g);  /* memory being freed in background must be available */
+  if (origkind == KGC_GEN && !isemergency) {
+    fullgen(L, g);
+    callgenfinalizers(L, g);
+    return;
+  }
+  g->gckind = isemergency ? KGC_EMERGENCY : KGC_NORMAL;  /* set flag */
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
   /* finish any pending sweep phase to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpause));
   luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
+  if (g->parmark != NULL) {  /* helpers available? */
+    propagateall(g);  /* do the whole propagation at once */
+    g->gcstate = GCSatomic;
+  }
   luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
-  g->gckind = KGC_NORMAL;
-  setpause(g);
+  g->gckind = origkind;
+  if (origkind == KGC_GEN) {  /* emergency collection in generational mode? */
+    /* generational mode must be kept in propagate phase */
+    luaC_runtilstate(L, bitmask(GCSpropagate));
+    setminordebt(g);
+  }
+  else
+    setpause(g);
 }
 
 /* }====================================================== */
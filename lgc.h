@@ -22,6 +22,12 @@
 ** allweak, ephemeron) so that it can be visited again before finishing
 ** the collection cycle. These lists have no meaning when the invariant
 ** is not being enforced (e.g., sweep phase).
+**
+** In generational mode, objects that survive a collection become old
+** and keep their colors, so that the invariant holds between cycles.
+** A young collection only visits white (young) objects plus the old
+** ones in the gray lists: objects caught by barriers, threads, and
+** weak tables (the last two stay gray, and in 'grayagain', forever).
 */
 
 
@@ -79,6 +85,7 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define OLDBIT		4  /* object is old (only in generational mode) */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -91,6 +98,11 @@
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+#define isold(x)	testbit((x)->marked, OLDBIT)
+#define resetoldbit(x)	resetbit((x)->marked, OLDBIT)
+
+#define isgenerational(g)	((g)->gckind == KGC_GEN)
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
 #define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
@@ -136,9 +148,19 @@ LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
+LUAI_FUNC void luaC_changemode (lua_State *L, int mode);
+LUAI_FUNC int luaC_setparallel (lua_State *L, int n);
+LUAI_FUNC int luaC_setbgfree (lua_State *L, int on);
+#if defined(LUA_USE_PARALLELGC)
+LUAI_FUNC int luaC_deferfree (global_State *g, void *block, size_t size);
+LUAI_FUNC void luaC_setbgalloc (global_State *g, lua_Alloc f, void *ud);
+#else
+#define luaC_setbgalloc(g,f,ud)	((void)0)
+#endif
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
+LUAI_FUNC void luaC_protobarrier_ (lua_State *L, Proto *p);
 LUAI_FUNC void luaC_upvalbarrier_ (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
@@ -0,0 +1,294 @@
+/*
+** $Id: lhashbench.c $
+** Benchmark for the string hash (see 'luai_hashstring' in lstring.c)
+** See Copyright Notice in lua.h
+*/
+
+#define lhashbench_c
+
+#include "lprefix.h"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "lstring.h"
+
+
+/*
+** Build with:
+**   make linux lhashbench
+** To run the interpreter part with the old hash, build everything with
+**   make linux lhashbench MYCFLAGS=-DLUAI_HASHLIMIT=5
+** Usage: lhashbench [nkeys]
+**
+** The first part compares 'luaS_hash' (the hash built into the library)
+** with a copy of the old sampled hash, on keys that share prefixes or
+** suffixes: it times each hash, an intern table modeled on 'strt'
+** (chains of hashes in a power-of-2 array, each lookup comparing the
+** full string of every entry with the same hash), and counts collisions
+** of main positions in a table part of the next power-of-2 size. The
+** second part times interning and table lookups in the interpreter,
+** with whichever hash the library was built with.
+*/
+
+
+#define SEED		0x2545f491u	/* any fixed seed */
+#define KEYSIZE		256		/* room for each key */
+
+
+/* the hash used before 'hashwords', with LUAI_HASHLIMIT == 5 */
+static unsigned int hashsampled (const char *str, size_t l,
+                                 unsigned int seed) {
+  unsigned int h = seed ^ (unsigned int)l;
+  size_t step = (l >> 5) + 1;
+  for (; l >= step; l -= step)
+    h ^= ((h<<5) + (h>>2) + (unsigned char)str[l - 1]);
+  return h;
+}
+
+
+static unsigned int hashfull (const char *str, size_t l,
+                              unsigned int seed) {
+  return luaS_hash(str, l, seed);
+}
+
+
+typedef unsigned int (*HashF) (const char *str, size_t l, unsigned int seed);
+
+
+typedef struct KeySet {
+  const char *name;
+  int n;
+  char *s;  /* 'n' keys of KEYSIZE bytes each */
+  size_t *len;
+} KeySet;
+
+
+#define getkey(ks,i)	((ks)->s + (size_t)(i) * KEYSIZE)
+
+
+/*
+** fill 'ks' with keys made of 'prefix', a counter, and 'nsuffix' copies
+** of the character 'suffix'
+*/
+static void makekeys (KeySet *ks, const char *name, int n,
+                      const char *prefix, int nsuffix, char suffix) {
+  int i;
+  ks->name = name;
+  ks->n = n;
+  ks->s = (char *)malloc((size_t)n * KEYSIZE);
+  ks->len = (size_t *)malloc((size_t)n * sizeof(size_t));
+  if (ks->s == NULL || ks->len == NULL) {
+    fprintf(stderr, "lhashbench: not enough memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < n; i++) {
+    char *k = getkey(ks, i);
+    int l = sprintf(k, "%s%d", prefix, i);
+    memset(k + l, suffix, (size_t)nsuffix);
+    ks->len[i] = (size_t)(l + nsuffix);
+  }
+}
+
+
+static double elapsed (clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+static unsigned int pow2 (unsigned int n) {
+  unsigned int s = 1;
+  while (s < n) s <<= 1;
+  return s;
+}
+
+
+/*
+** Model of the short-string table: insert every key, then look each
+** one up again; returns the time, and in '*cmps' the average number of
+** string comparisons per lookup.
+*/
+static double intern (const KeySet *ks, HashF h, double *cmps) {
+  unsigned int size = pow2((unsigned int)ks->n);
+  int *head = (int *)malloc(size * sizeof(int));
+  int *next = (int *)malloc((size_t)ks->n * sizeof(int));
+  unsigned int *hash = (unsigned int *)malloc((size_t)ks->n *
+                                                 sizeof(unsigned int));
+  unsigned long ncmp = 0;
+  clock_t start = clock();
+  int pass, i;
+  for (i = 0; i < (int)size; i++) head[i] = -1;
+  for (pass = 0; pass < 2; pass++) {  /* insert, then lookup */
+    for (i = 0; i < ks->n; i++) {
+      const char *k = getkey(ks, i);
+      size_t l = ks->len[i];
+      unsigned int hk = (*h)(k, l, SEED);
+      int e;
+      for (e = head[hk & (size - 1)]; e != -1; e = next[e]) {
+        if (hash[e] == hk) {
+          if (pass == 1) ncmp++;
+          if (ks->len[e] == l && memcmp(getkey(ks, e), k, l) == 0)
+            break;  /* found it */
+        }
+      }
+      if (e == -1) {  /* new string? */
+        hash[i] = hk;
+        next[i] = head[hk & (size - 1)];
+        head[hk & (size - 1)] = i;
+      }
+    }
+  }
+  *cmps = (double)ncmp / ks->n;
+  free(head); free(next); free(hash);
+  return elapsed(start);
+}
+
+
+static int cmphash (const void *a, const void *b) {
+  unsigned int x = *(const unsigned int *)a;
+  unsigned int y = *(const unsigned int *)b;
+  return (x > y) - (x < y);
+}
+
+
+/*
+** number of keys whose main position in a hash part of the next
+** power-of-2 size is already taken, and number of keys whose full
+** hash value equals that of an earlier key
+*/
+static void collisions (const KeySet *ks, HashF h, int *nmain, int *nfull) {
+  unsigned int size = pow2((unsigned int)ks->n);
+  unsigned char *used = (unsigned char *)calloc(size, 1);
+  unsigned int *hash = (unsigned int *)malloc((size_t)ks->n *
+                                                 sizeof(unsigned int));
+  int i;
+  *nmain = *nfull = 0;
+  for (i = 0; i < ks->n; i++) {
+    hash[i] = (*h)(getkey(ks, i), ks->len[i], SEED);
+    if (used[hash[i] & (size - 1)]++)
+      (*nmain)++;
+  }
+  qsort(hash, (size_t)ks->n, sizeof(unsigned int), cmphash);
+  for (i = 1; i < ks->n; i++)
+    if (hash[i] == hash[i - 1]) (*nfull)++;
+  free(used); free(hash);
+}
+
+
+static void compare (const KeySet *ks) {
+  static const struct { const char *name; HashF f; } hs[] = {
+    {"full", hashfull}, {"sampled", hashsampled}
+  };
+  int i;
+  printf("%s (%d keys, %d bytes or more):\n", ks->name, ks->n,
+                                             (int)ks->len[0]);
+  for (i = 0; i < 2; i++) {
+    volatile unsigned int sink = 0;
+    double cmps, tintern;
+    int nmain, nfull, k;
+    clock_t start = clock();
+    for (k = 0; k < ks->n; k++)
+      sink ^= (*hs[i].f)(getkey(ks, k), ks->len[k], SEED);
+    printf("  %-8s hash %6.1f ns/key", hs[i].name,
+                                      elapsed(start) * 1e9 / ks->n);
+    tintern = intern(ks, hs[i].f, &cmps);
+    collisions(ks, hs[i].f, &nmain, &nfull);
+    printf("  intern %7.3fs (%6.2f cmp/lookup)  main-pos collisions %7d"
+           "  equal hashes %7d\n", tintern, cmps, nmain, nfull);
+    (void)sink;
+  }
+}
+
+
+/*
+** Interning and lookups through the interpreter: build each key with
+** string concatenation (interning short keys, creating long ones), use
+** them as table keys, and look them up again.
+*/
+static const char vmcode[] =
+  "local n, prefix, suffix = ...\n"
+  "local t0 = os.clock()\n"
+  "local keys = {}\n"
+  "for i = 1, n do keys[i] = prefix .. i .. suffix end\n"
+  "local tintern = os.clock() - t0\n"
+  "t0 = os.clock()\n"
+  "local t = {}\n"
+  "for i = 1, n do t[keys[i]] = i end\n"
+  "for p = 1, 5 do\n"
+  "  for i = 1, n do assert(t[keys[i]] == i) end\n"
+  "end\n"
+  "return tintern, os.clock() - t0\n";
+
+
+static void vmrun (lua_State *L, const char *name, int n,
+                   const char *prefix, int nsuffix, char suffix) {
+  char buff[KEYSIZE];
+  memset(buff, suffix, (size_t)nsuffix);
+  if (luaL_loadbuffer(L, vmcode, sizeof(vmcode) - 1, "=vm") != LUA_OK) {
+    fprintf(stderr, "lhashbench: %s\n", lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  lua_pushinteger(L, n);
+  lua_pushstring(L, prefix);
+  lua_pushlstring(L, buff, (size_t)nsuffix);
+  if (lua_pcall(L, 3, 2, 0) != LUA_OK) {
+    fprintf(stderr, "lhashbench: %s\n", lua_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  printf("  %-16s create %7.3fs  insert + 5 lookups %7.3fs\n", name,
+         lua_tonumber(L, -2), lua_tonumber(L, -1));
+  lua_pop(L, 2);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+}
+
+
+/* prefixes shared by the keys (short keys stay under LUAI_MAXSHORTLEN) */
+#define SPREFIX		"app.config.section."
+#define LPREFIX		"/usr/local/share/lua/5.3/some/module/"
+
+
+int main (int argc, char **argv) {
+  int n = (argc > 1) ? atoi(argv[1]) : 50000;
+  KeySet ks;
+  lua_State *L;
+  if (n < 1 || n > 10000000) {
+    fprintf(stderr, "usage: %s [nkeys]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  printf("-- hash functions\n");
+  makekeys(&ks, "short, shared prefix", n, SPREFIX, 0, 0);
+  compare(&ks);
+  free(ks.s); free(ks.len);
+  makekeys(&ks, "long, shared prefix and suffix", n, LPREFIX, 40, '.');
+  compare(&ks);
+  free(ks.s); free(ks.len);
+  makekeys(&ks, "long, shared suffix", n, "", 120, '-');
+  compare(&ks);
+  free(ks.s); free(ks.len);
+#if defined(LUAI_HASHLIMIT)
+  printf("-- interpreter (sampled hash, LUAI_HASHLIMIT=%d)\n", LUAI_HASHLIMIT);
+#else
+  printf("-- interpreter (full hash)\n");
+#endif
+  L = luaL_newstate();
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  luaL_openlibs(L);
+  vmrun(L, "short keys", n, "k", 0, 0);
+  vmrun(L, "short, prefix", n, SPREFIX, 0, 0);
+  vmrun(L, "long, prefix", n, LPREFIX, 40, '.');
+  vmrun(L, "long, suffix", n, "", 120, '-');
+  lua_close(L);
+  return EXIT_SUCCESS;
+}
+
@@ -57,6 +57,16 @@ static const luaL_Reg loadedlibs[] = {
 };
 
 
+/*
+** these libs are preloaded and must be required before used (so that
+** they do not add globals to existing programs)
+*/
+static const luaL_Reg preloadedlibs[] = {
+  {LUA_ARRAYLIBNAME, luaopen_array},
+  {NULL, NULL}
+};
+
+
 LUALIB_API void luaL_openlibs (lua_State *L) {
   const luaL_Reg *lib;
   /* "require" functions from 'loadedlibs' and set results to global table */
@@ -64,5 +74,12 @@ LUALIB_API void luaL_openlibs (lua_State *L) {
     luaL_requiref(L, lib->name, lib->func, 1);
     lua_pop(L, 1);  /* remove lib */
   }
+  /* add open functions from 'preloadedlibs' into 'package.preload' table */
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  for (lib = preloadedlibs; lib->func; lib++) {
+    lua_pushcfunction(L, lib->func);
+    lua_setfield(L, -2, lib->name);
+  }
+  lua_pop(L, 1);  /* remove _PRELOAD table */
 }
 
@@ -200,12 +200,42 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** Freed array and hash parts of tables with up to 2^TCACHEBITS elements
+** are kept for reuse, up to TCACHEMAX vectors for each size, until the
+** collector finishes its current cycle.
+*/
+#if !defined(TCACHEBITS)
+#define TCACHEBITS		10
+#define TCACHEMAX		8
+#endif
+
+
 /* minimum size for string buffer */
 #if !defined(LUA_MINBUFFER)
 #define LUA_MINBUFFER	32
 #endif
 
 
+/*
+** With LUA_USE_THREADLOCK, all threads of a state share a mutex (see
+** lstate.c) that is held while running inside the core; so, different
+** OS threads can use the same state, each one with its own Lua thread.
+*/
+#if defined(LUA_USE_THREADLOCK)
+LUAI_FUNC void luai_lockopen (lua_State *L);
+LUAI_FUNC void luai_lockclose (lua_State *L);
+LUAI_FUNC void luai_lock (lua_State *L);
+LUAI_FUNC void luai_unlock (lua_State *L);
+LUAI_FUNC void luai_lockyield (lua_State *L);
+#define lua_lock(L)		luai_lock(L)
+#define lua_unlock(L)		luai_unlock(L)
+#define luai_threadyield(L)	luai_lockyield(L)
+#define luai_userstateopen(L)	luai_lockopen(L)
+#define luai_userstateclose(L)	luai_lockclose(L)
+#endif
+
+
 /*
 ** macros that are executed whenever program enters the Lua core
 ** ('lua_lock') and leaves the core ('lua_unlock')
@@ -254,6 +284,24 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** Reference counters of objects used by several global states, which
+** may run in different threads. 'luai_refdec' returns the new count;
+** 'luai_refget' reads a counter changed by other threads.
+*/
+#if !defined(luai_refinc)
+#if defined(__GNUC__)
+#define luai_refinc(r)	((void)__atomic_add_fetch(&(r), 1, __ATOMIC_RELAXED))
+#define luai_refdec(r)	__atomic_sub_fetch(&(r), 1, __ATOMIC_ACQ_REL)
+#define luai_refget(r)	__atomic_load_n(&(r), __ATOMIC_RELAXED)
+#else
+#define luai_refinc(r)	((void)++(r))	/* not thread safe! */
+#define luai_refdec(r)	(--(r))
+#define luai_refget(r)	(r)
+#endif
+#endif
+
+
 
 /*
 ** The luai_num* macros define the primitive operations over numbers.
@@ -82,6 +82,11 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
 #if defined(HARDMEMTESTS)
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
+#endif
+#if defined(LUA_USE_PARALLELGC)
+  if (nsize == 0 && g->bgfree != NULL && luaC_deferfree(g, block, realosize))
+    newblock = NULL;  /* block will be freed by a background thread */
+  else
 #endif
   newblock = (*g->frealloc)(g->ud, block, osize, nsize);
   if (newblock == NULL && nsize > 0) {
@@ -268,6 +268,14 @@ static lua_CFunction lsys_sym (lua_State *L, void *lib, const char *sym) {
 #define LUA_CPATH_VAR   "LUA_CPATH"
 #endif
 
+/*
+** LUA_BCCACHE_VAR is the name of the environment variable that gives
+** the directory for the bytecode cache of 'require'.
+*/
+#if !defined(LUA_BCCACHE_VAR)
+#define LUA_BCCACHE_VAR "LUA_BCCACHE"
+#endif
+
 
 #define AUXMARK         "\1"	/* auxiliary mark */
 
@@ -308,6 +316,24 @@ static void setpath (lua_State *L, const char *fieldname,
   lua_pop(L, 1);  /* pop versioned variable name */
 }
 
+
+/*
+** Set 'package.bccache' from the environment; it stays nil (no
+** bytecode cache) when the variable is absent.
+*/
+static void setcachedir (lua_State *L) {
+  const char *nver = lua_pushfstring(L, "%s%s", LUA_BCCACHE_VAR,
+                                                LUA_VERSUFFIX);
+  const char *dir = getenv(nver);  /* use versioned name */
+  if (dir == NULL)  /* no environment variable? */
+    dir = getenv(LUA_BCCACHE_VAR);  /* try unversioned name */
+  if (dir != NULL && !noenv(L)) {
+    lua_pushstring(L, dir);
+    lua_setfield(L, -3, "bccache");
+  }
+  lua_pop(L, 1);  /* pop versioned variable name */
+}
+
 /* }================================================================== */
 
 
@@ -492,12 +518,206 @@ static int checkload (lua_State *L, int stat, const char *filename) {
 }
 
 
+/*
+** {==================================================================
+** Bytecode cache
+** ===================================================================
+** When 'package.bccache' is a directory name, 'searcher_Lua' keeps a
+** precompiled copy of each module it loads in that directory. Entries
+** are keyed by the source's resolved path ('realpath'), and a cache file
+** starts with a header holding that path plus the source's device,
+** inode, size, and modification time (to the nanosecond); it is used
+** only when all of them still match the source, so that a shared cache
+** does not mix up files from different trees. Hits are mapped into
+** memory and handed to 'lua_load' in one piece. Binary chunks are not
+** verified, so the cache directory must be as trusted as the sources
+** themselves.
+*/
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHEMAGIC	"\033LuaCache\n"
+
+
+/*
+** nanoseconds of the modification time in a 'struct stat' (POSIX 2008
+** 'st_mtim'; older glibc modes and Darwin call it 'st_mtimensec')
+*/
+#if !defined(l_mtimensec)
+#if (defined(__GLIBC__) && !defined(__USE_XOPEN2K8)) || defined(__APPLE__)
+#define l_mtimensec(st)		((st)->st_mtimensec)
+#else
+#define l_mtimensec(st)		((st)->st_mtim.tv_nsec)
+#endif
+#endif
+
+
+typedef struct LoadCache {
+  const char *p;  /* chunk not yet handed to 'lua_load' */
+  size_t size;
+} LoadCache;
+
+
+static const char *getcached (lua_State *L, void *ud, size_t *size) {
+  LoadCache *lc = (LoadCache *)ud;
+  (void)L;  /* not used */
+  if (lc->size == 0) return NULL;
+  *size = lc->size;
+  lc->size = 0;  /* whole chunk goes in a single piece */
+  return lc->p;
+}
+
+
+static int writecache (lua_State *L, const void *b, size_t size, void *f) {
+  (void)L;  /* not used */
+  return (size != 0 && fwrite(b, size, 1, (FILE *)f) != 1);
+}
+
+
+/*
+** Push the name of the cache file for 'filename' in directory 'dir'.
+** Different sources can share a name; the header tells them apart.
+*/
+static const char *cachename (lua_State *L, const char *dir,
+                                            const char *filename) {
+  char buff[16];
+  unsigned int h = 2166136261u;  /* FNV-1a */
+  for (; *filename; filename++)
+    h = (h ^ (unsigned char)*filename) * 16777619u;
+  l_sprintf(buff, sizeof(buff), "%08x", h & 0xffffffffu);
+  return lua_pushfstring(L, "%s" LUA_DIRSEP "%s.luac", dir, buff);
+}
+
+
+/*
+** Try to load 'cname' as the cached chunk with header 'hdr' (of
+** length 'lhdr'). Leaves the function on the stack and returns 1 on
+** success; leaves the stack unchanged and returns 0 otherwise.
+*/
+static int loadcachefile (lua_State *L, const char *cname,
+                          const char *hdr, size_t lhdr,
+                          const char *filename) {
+  struct stat st;
+  LoadCache lc;
+  void *map;
+  int status;
+  int fd = open(cname, O_RDONLY);
+  if (fd < 0) return 0;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size <= lhdr) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  /* mapping stays valid */
+  if (map == MAP_FAILED) return 0;
+  if (memcmp(map, hdr, lhdr) != 0)  /* stale or foreign entry? */
+    status = LUA_ERRFILE;
+  else {
+    lc.p = (const char *)map + lhdr;
+    lc.size = (size_t)st.st_size - lhdr;
+    lua_pushfstring(L, "@%s", filename);
+    status = lua_load(L, getcached, &lc, lua_tostring(L, -1), "b");
+    lua_remove(L, -2);  /* remove chunk name */
+    if (status != LUA_OK) lua_pop(L, 1);  /* remove error message */
+  }
+  munmap(map, (size_t)st.st_size);
+  return (status == LUA_OK);
+}
+
+
+/*
+** Store the function on the top of the stack as the cache entry
+** 'cname'. Entries are written to a fresh file and then renamed, so
+** that concurrent loaders never see a partial one. Errors are ignored;
+** the module is simply compiled again next time.
+*/
+static void storecache (lua_State *L, const char *cname,
+                        const char *hdr, size_t lhdr) {
+  const char *tmp = lua_pushfstring(L, "%s.XXXXXX", cname);
+  char *tname = (char *)lua_newuserdata(L, strlen(tmp) + 1);
+  int fd = mkstemp(strcpy(tname, tmp));
+  FILE *f;
+  int err;
+  if (fd < 0) {
+    lua_pop(L, 2);  /* remove template and buffer */
+    return;
+  }
+  f = fdopen(fd, "wb");
+  if (f == NULL) {
+    close(fd);
+    err = 1;
+  }
+  else {
+    lua_pushvalue(L, -3);  /* function to be dumped */
+    err = (fwrite(hdr, 1, lhdr, f) != lhdr);
+    err = err || lua_dump(L, writecache, f, 0) != 0;
+    err = (fclose(f) != 0) || err;
+    lua_pop(L, 1);  /* remove function copy */
+  }
+  if (err || rename(tname, cname) != 0)
+    remove(tname);
+  lua_pop(L, 2);  /* remove template and buffer */
+}
+
+
+/*
+** Load the Lua file 'filename', going through the cache directory
+** 'package.bccache' when there is one.
+*/
+static int loadcached (lua_State *L, const char *filename) {
+  struct stat st;
+  const char *dir, *cname, *hdr, *rname;
+  char *rpath = NULL;
+  size_t lhdr;
+  int status;
+  lua_getfield(L, lua_upvalueindex(1), "bccache");
+  dir = lua_tostring(L, -1);
+  if (dir == NULL || stat(filename, &st) != 0 ||
+      (rpath = realpath(filename, NULL)) == NULL) {  /* no cache? */
+    lua_pop(L, 1);
+    return luaL_loadfile(L, filename);
+  }
+  rname = lua_pushstring(L, rpath);
+  free(rpath);
+  cname = cachename(L, dir, rname);
+  hdr = lua_pushfstring(L, CACHEMAGIC "%I.%I %I %I:%I\n%s\n",
+                        (lua_Integer)st.st_mtime,
+                        (lua_Integer)l_mtimensec(&st),
+                        (lua_Integer)st.st_size, (lua_Integer)st.st_dev,
+                        (lua_Integer)st.st_ino, rname);
+  lhdr = lua_rawlen(L, -1);
+  if (loadcachefile(L, cname, hdr, lhdr, filename))
+    status = LUA_OK;
+  else {  /* miss: compile source and fill the cache */
+    status = luaL_loadfile(L, filename);
+    if (status == LUA_OK)
+      storecache(L, cname, hdr, lhdr);
+  }
+  lua_replace(L, -5);  /* result replaces 'dir' */
+  lua_pop(L, 3);  /* remove resolved name, cache name, and header */
+  return status;
+}
+
+#else				/* }{ */
+
+#define loadcached(L,f)		luaL_loadfile(L, f)
+
+#endif				/* } */
+
+/* }================================================================== */
+
+
 static int searcher_Lua (lua_State *L) {
   const char *filename;
   const char *name = luaL_checkstring(L, 1);
   filename = findfile(L, name, "path", LUA_LSUBSEP);
   if (filename == NULL) return 1;  /* module not found in this path */
-  return checkload(L, (luaL_loadfile(L, filename) == LUA_OK), filename);
+  return checkload(L, (loadcached(L, filename) == LUA_OK), filename);
 }
 
 
@@ -771,6 +991,7 @@ LUAMOD_API int luaopen_package (lua_State *L) {
   /* set paths */
   setpath(L, "path", LUA_PATH_VAR, LUA_PATH_DEFAULT);
   setpath(L, "cpath", LUA_CPATH_VAR, LUA_CPATH_DEFAULT);
+  setcachedir(L);
   /* store config information */
   lua_pushliteral(L, LUA_DIRSEP "\n" LUA_PATH_SEP "\n" LUA_PATH_MARK "\n"
                      LUA_EXEC_DIR "\n" LUA_IGMARK "\n");
@@ -424,6 +424,7 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte fixed;  /* vectors that live in the load buffer (FIXED* bits) */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -434,16 +435,27 @@ typedef struct Proto {
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
+  unsigned int *icache;  /* inline caches (one per instruction) */
   struct Proto **p;  /* functions defined inside the function */
   int *lineinfo;  /* map from opcodes to source lines (debug information) */
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
   TString  *source;  /* used for debug information */
+  lua_SharedProto *shared;  /* image holding the 'fixed' vectors, if any */
   GCObject *gclist;
 } Proto;
 
 
+/*
+** Bits in 'fixed': vectors that point into the caller's buffer of a
+** zero-copy load (mode 'z') or into a shared image ('shared') instead
+** of memory owned by the prototype
+*/
+#define FIXEDCODE	1	/* 'code' */
+#define FIXEDLINES	2	/* 'lineinfo' */
+
+
 
 /*
 ** Lua Upvalues
@@ -517,6 +529,9 @@ typedef struct Table {
   TValue *array;  /* array part */
   Node *node;
   Node *lastfree;  /* any free position is before this position */
+#if LUA_USE_SWISSTABLE
+  unsigned int growthleft;  /* number of empty nodes that can still be used */
+#endif
   struct Table *metatable;
   GCObject *gclist;
 } Table;
@@ -36,6 +36,30 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation GC运行内存分配速度的两倍*/
 #endif
 
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL	20  /* young collection after memory grows 20% */
+#endif
+
+#if !defined(LUAI_GENMAJORMUL)
+#define LUAI_GENMAJORMUL	100  /* major collection after memory doubles */
+#endif
+
+#if !defined(LUAI_MAXTHREADPOOL)
+#define LUAI_MAXTHREADPOOL	256  /* dead threads kept for reuse */
+#endif
+
+/* largest stack of a thread kept in the pool */
+#define POOLSTACKSIZE	(8*BASIC_STACK_SIZE)
+
+/*
+** memory used by a thread with its stack and CallInfo list; threads in
+** the pool are not counted as in use, so that reusing one charges the
+** collector exactly as creating it would
+*/
+#define threadsize(L1)	cast(l_mem, sizeof(LX) + \
+			  (L1)->stacksize * sizeof(TValue) + \
+			  (L1)->nci * sizeof(CallInfo))
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -242,6 +266,8 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->ci = NULL;
   L->nci = 0;
   L->stacksize = 0;
+  L->stackhint = 0;
+  L->stackpeak = 0;
   L->twups = L;  /* thread has no upvalues */
   L->errorJmp = NULL;
   L->nCcalls = 0;
@@ -257,12 +283,33 @@ static void preinit_thread (lua_State *L, global_State *g) {
 }
 
 
+/*
+** free all threads kept for reuse
+*/
+static void freethreadpool (lua_State *L) {
+  global_State *g = G(L);
+  while (g->threadpool != NULL) {
+    lua_State *L1 = g->threadpool;
+    g->threadpool = L1->twups;
+    g->GCdebt += threadsize(L1);  /* count it again before freeing it */
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
+  g->nthreadpool = 0;
+}
+
+
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  luaC_setparallel(L, 0);  /* stop marking helpers */
+  luaC_setbgfree(L, 0);  /* free queued blocks and stop that thread */
   luaF_close(L, L->stack);  /* close all upvalues for this thread 关闭此线程的所有upvalue*/
   luaC_freeallobjects(L);  /* collect all objects收集所有对象 */
+  luaH_trimcache(L);  /* free vectors kept by 'luaH_free' */
+  freethreadpool(L);
   if (g->version)  /* closing a fully built state?关闭一个完整的国家? */
     luai_userstateclose(L);
+  luaS_rehash(L, MAX_INT);  /* finish any pending resize (table is empty) */
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
@@ -273,10 +320,19 @@ static void close_state (lua_State *L) {
 LUA_API lua_State *lua_newthread (lua_State *L) {
   global_State *g = G(L);
   lua_State *L1;
+  int reused;
   lua_lock(L);
   luaC_checkGC(L);
-  /* create new thread创建新线程 */
-  L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+  reused = (g->threadpool != NULL);
+  if (reused) {  /* reuse a dead thread, with its stack and 'ci' list */
+    L1 = g->threadpool;
+    g->threadpool = L1->twups;
+    g->nthreadpool--;
+    g->GCdebt += threadsize(L1);  /* as if just allocated */
+    L1->twups = L1;  /* thread has no upvalues */
+  }
+  else  /* create new thread创建新线程 */
+    L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
   L1->marked = luaC_white(g);
   L1->tt = LUA_TTHREAD;
   /* link it on list 'allgc' 将其链接到列表“allgc”*/
@@ -285,7 +341,8 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   /* anchor it on L stack把它固定在L堆栈上 */
   setthvalue(L, L->top, L1);
   api_incr_top(L);
-  preinit_thread(L1, g);
+  if (!reused)
+    preinit_thread(L1, g);
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
@@ -294,17 +351,75 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack初始化堆栈 */
+  if (!reused)
+    stack_init(L1, L);  /* init stack初始化堆栈 */
   lua_unlock(L);
   return L1;
 }
 
 
+/*
+** Bring thread 'L1' back to the state of a new thread, but keeping its
+** stack and its list of CallInfo structures
+*/
+void luaE_resetthread (lua_State *L1) {
+  CallInfo *ci = &L1->base_ci;
+  StkId p;
+  luaF_close(L1, L1->stack);  /* close all upvalues for this thread */
+  lua_assert(L1->openupval == NULL);
+  for (p = L1->stack; p < L1->stack + L1->stacksize; p++)
+    setnilvalue(p);  /* erase stack */
+  L1->top = L1->stack;
+  ci->previous = NULL;  /* ('ci->next' keeps the list for reuse) */
+  ci->callstatus = 0;
+  ci->func = L1->top++;  /* 'function' entry for this 'ci' */
+  ci->top = L1->top + LUA_MINSTACK;
+  L1->ci = ci;
+  L1->status = LUA_OK;
+  L1->errorJmp = NULL;
+  L1->nCcalls = 0;
+  L1->nny = 1;
+  L1->errfunc = 0;
+  L1->hook = NULL;
+  L1->hookmask = 0;
+  L1->basehookcount = 0;
+  L1->allowhook = 1;
+  resethookcount(L1);
+  L1->stackhint = L1->stackpeak = 0;
+}
+
+
+LUA_API int lua_resetthread (lua_State *L) {
+  int status;
+  lua_lock(L);
+  api_check(L, L->status != LUA_OK || L->ci == &L->base_ci,
+                "cannot reset a running thread");
+  status = L->status;
+  luaE_resetthread(L);
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Free a dead thread; while the pool has room, a thread with a small
+** stack goes there instead, to be reused by 'lua_newthread'.
+*/
 void luaE_freethread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
   LX *l = fromstate(L1);
   luaF_close(L1, L1->stack);  /* close all upvalues for this thread 关闭此线程的所有upvalue*/
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
+  if (g->nthreadpool < LUAI_MAXTHREADPOOL && L1->stack != NULL &&
+      L1->stacksize <= POOLSTACKSIZE) {
+    luaE_resetthread(L1);
+    L1->twups = g->threadpool;  /* link it in the pool */
+    g->threadpool = L1;
+    g->nthreadpool++;
+    g->GCdebt -= threadsize(L1);  /* as if freed */
+    return;
+  }
   freestack(L1);
   luaM_free(L, l);
 }
@@ -330,7 +445,9 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcrunning = 0;  /* no GC while building state建立状态时无GC */
   g->GCestimate = 0;
   g->strt.size = g->strt.nuse = 0;
-  g->strt.hash = NULL;
+  g->strt.hash = g->strt.oldhash = NULL;
+  memset(&g->nodecache, 0, sizeof(g->nodecache));
+  memset(&g->arraycache, 0, sizeof(g->arraycache));
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->version = NULL;
@@ -341,11 +458,17 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->threadpool = NULL;
+  g->parmark = NULL;
+  g->bgfree = NULL;
+  g->nthreadpool = 0;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->genminormul = LUAI_GENMINORMUL;
+  g->genmajormul = LUAI_GENMAJORMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state内存分配错误：自由部分状态 */
@@ -363,3 +486,103 @@ LUA_API void lua_close (lua_State *L) {
 }
 
 
+
+
+
+/*
+** {======================================================
+** Thread lock
+** =======================================================
+*/
+
+#if defined(LUA_USE_THREADLOCK)
+
+#include <pthread.h>
+#include <sched.h>
+
+/*
+** All threads of a state keep a pointer to the state's lock in the last
+** slot of their extra space ('lua_newthread' copies it from the main
+** thread).
+*/
+typedef struct LuaLock {
+  pthread_mutex_t mutex;
+  int waiting;  /* number of OS threads blocked on 'mutex' */
+} LuaLock;
+
+#define getlock(L)	(*cast(LuaLock **, cast(char *, L) - sizeof(LuaLock *)))
+
+
+void luai_lockopen (lua_State *L) {
+  LuaLock *l;
+  pthread_mutexattr_t attr;
+  int res;
+  getlock(L) = NULL;
+  l = luaM_new(L, LuaLock);
+  l->waiting = 0;
+  pthread_mutexattr_init(&attr);
+#if defined(LUAI_ASSERT)
+  /* catch unbalanced lock/unlock pairs */
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+#endif
+  res = pthread_mutex_init(&l->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (res != 0) {
+    luaM_free(L, l);
+    luaD_throw(L, LUA_ERRMEM);
+  }
+  getlock(L) = l;
+}
+
+
+/*
+** Called from 'close_state', either by 'lua_close' (with the lock held)
+** or when 'lua_newstate' fails (without it).
+*/
+void luai_lockclose (lua_State *L) {
+  LuaLock *l = getlock(L);
+  if (l != NULL) {
+    pthread_mutex_trylock(&l->mutex);  /* own it in both cases */
+    pthread_mutex_unlock(&l->mutex);
+    pthread_mutex_destroy(&l->mutex);
+    luaM_free(L, l);
+    getlock(L) = NULL;
+  }
+}
+
+
+void luai_lock (lua_State *L) {
+  LuaLock *l = getlock(L);
+  if (pthread_mutex_trylock(&l->mutex) != 0) {  /* contention? */
+    int res;
+    luai_refinc(l->waiting);
+    res = pthread_mutex_lock(&l->mutex);
+    (void)luai_refdec(l->waiting);
+    lua_assert(res == 0); UNUSED(res);
+  }
+}
+
+
+void luai_unlock (lua_State *L) {
+  int res = pthread_mutex_unlock(&getlock(L)->mutex);
+  lua_assert(res == 0); UNUSED(res);
+}
+
+
+/*
+** Called at safe points of the interpreter loop: if other OS threads
+** are waiting for the lock, give them a chance to run.
+*/
+void luai_lockyield (lua_State *L) {
+  LuaLock *l = getlock(L);
+  if (luai_refget(l->waiting) > 0) {
+    luai_unlock(L);
+    sched_yield();
+    luai_lock(L);
+  }
+}
+
+#endif
+
+/* }====================================================== */
+
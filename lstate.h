@@ -69,15 +69,29 @@ struct lua_longjmp;  /* defined in ldo.c */
 /* kinds of Garbage Collection各种各样的垃圾收集*/
 #define KGC_NORMAL	0
 #define KGC_EMERGENCY	1	/* gc was forced by an allocation failure gc是由于分配失败而被迫的*/
+#define KGC_GEN		2	/* generational gc 分代垃圾收集*/
 
 
 typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
   int size;
+  TString **oldhash;  /* old buckets while resizing (or NULL) 调整大小期间的旧桶(或NULL) */
+  int oldsize;  /* size of 'oldhash' 'oldhash'的大小 */
+  int migrated;  /* next old bucket to be moved 下一个要移动的旧桶 */
 } stringtable;
 
 
+/*
+** free vectors of a given kind kept for reuse, binned by log2 of their
+** number of elements (see ltable.c)
+*/
+typedef struct VecCache {
+  void *bin[TCACHEBITS + 1];  /* lists linked through first word */
+  lu_byte n[TCACHEBITS + 1];  /* number of vectors in each list */
+} VecCache;
+
+
 /*
 ** Information about a call.
 ** When a thread yields, 'func' is adjusted to pretend that the
@@ -151,6 +165,8 @@ typedef struct global_State {
   lu_mem GCmemtrav;  /* memory traversed by the GC GC遍历存储器*/
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use 使用中的非垃圾存储器的估计*/
   stringtable strt;  /* hash table for strings字符串哈希表 */
+  VecCache nodecache;  /* freed hash parts of tables 已释放的表哈希部分 */
+  VecCache arraycache;  /* freed array parts of tables 已释放的表数组部分 */
   TValue l_registry;
   unsigned int seed;  /* randomized seed for hashes哈希表随机种子 */
   lu_byte currentwhite;
@@ -167,10 +183,16 @@ typedef struct global_State {
   GCObject *allweak;  /* list of all-weak tables 一切弱小的表列表*/
   GCObject *tobefnz;  /* list of userdata to be GC  GC用户数据列表 */
   GCObject *fixedgc;  /* list of objects not to be collected 不收集对象列表*/
+  struct ParMark *parmark;  /* helper threads for parallel marking 并行标记的辅助线程 */
+  struct BgFree *bgfree;  /* thread that frees swept blocks 后台释放内存的线程 */
   struct lua_State *twups;  /* list of threads with open upvalues具有开放值的线程列表 */
+  struct lua_State *threadpool;  /* dead threads kept for reuse (linked by 'twups') 留待复用的死线程 */
+  int nthreadpool;  /* number of threads in 'threadpool' 线程池中的线程数 */
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step在每个GC步骤中调用的终结器的数目 */
   int gcpause;  /* size of pause between successive GCs 连续GCS间的停顿尺寸*/
   int gcstepmul;  /* GC 'granularity'“粒度” */
+  int genminormul;  /* control for young collections 控制年轻代收集的频率*/
+  int genmajormul;  /* control for major generational collections 控制分代模式下完全收集的频率*/
   lua_CFunction panic;  /* to be called in unprotected errors 在不受保护的错误中被调用*/
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number 指针版本号*/
@@ -202,6 +224,8 @@ struct lua_State {
   volatile lua_Hook hook;
   ptrdiff_t errfunc;  /* current error handling function (stack index)当前错误处理函数(堆栈索引) */
   int stacksize;
+  int stackhint;  /* size kept when shrinking (see 'lua_setstackhint') 收缩时保留的栈大小 */
+  int stackpeak;  /* recent stack demand (decays at each shrink check) 近期的栈需求 */
   int basehookcount;
   int hookcount;
   unsigned short nny;  /* number of non-yieldable calls in stack 栈中不可让步调用的数量 */
@@ -257,6 +281,7 @@ union GCUnion {
 
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC void luaE_resetthread (lua_State *L1);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_freeCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
@@ -0,0 +1,93 @@
+/*
+** $Id: lstrbench.c $
+** Benchmark for the bulk byte operations of the string library
+** See Copyright Notice in lua.h
+*/
+
+#define lstrbench_c
+
+#include "lprefix.h"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** Build with:
+**   make linux lstrbench
+** To measure the scalar code instead of the SSE2 paths, build everything
+** with
+**   make linux lstrbench MYCFLAGS=-DLUAI_NOSTRSIMD
+** Usage: lstrbench [scale]
+**
+** Times string.lower, string.upper, string.reverse, string.rep (with and
+** without a separator), a plain string.find, and a match of a missing
+** literal, on 16-byte strings (1M calls each) and on an 8MB text (20
+** calls each); 'scale' multiplies those counts.
+*/
+
+
+static const char benchcode[] =
+  "local scale = ...\n"
+  "local lower, upper, reverse, rep = string.lower, string.upper,\n"
+  "                                   string.reverse, string.rep\n"
+  "local find, match = string.find, string.match\n"
+  "local clock = os.clock\n"
+  "local function run (name, n, f, s, a, b)\n"
+  "  local t0 = clock()\n"
+  "  for i = 1, n do f(s, a, b) end\n"
+  "  print(string.format('  %-28s %8.3f', name, clock() - t0))\n"
+  "end\n"
+  "local function suite (title, s, n, nrep)\n"
+  "  print(string.format('%s (%d bytes, %d calls each):', title, #s, n))\n"
+  "  run('lower', n, lower, s)\n"
+  "  run('upper', n, upper, s)\n"
+  "  run('reverse', n, reverse, s)\n"
+  "  run('(\"ab\"):rep', n, rep, 'ab', nrep)\n"
+  "  run('(\"abc\"):rep with separator', n, rep, 'abc', nrep // 2, ',')\n"
+  "  run('plain find (missing)', n, find, s, 'lazy cat', 1, true)\n"
+  "  run('match of a missing literal', n, match, s, 'lazy cat')\n"
+  "end\n"
+  "suite('short strings', 'The Quick fox 16', 1000000 * scale, 8)\n"
+  "local line = 'The Quick Brown fox jumps over the Lazy dog; ' ..\n"
+  "             'lazy dogs sleep. '\n"
+  "local size = 8 * 1024 * 1024\n"
+  "local text = rep(line, size // #line + 1):sub(1, size)\n"
+  "suite('long strings', text, 20 * scale, size // 2)\n";
+
+
+int main (int argc, char **argv) {
+  int scale = (argc > 1) ? atoi(argv[1]) : 1;
+  lua_State *L;
+  if (scale < 1) {
+    fprintf(stderr, "usage: %s [scale]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  L = luaL_newstate();
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  luaL_openlibs(L);
+#if defined(__SSE2__) && !defined(LUAI_NOSTRSIMD)
+  printf("-- SSE2 code\n");
+#else
+  printf("-- scalar code\n");
+#endif
+  if (luaL_loadbuffer(L, benchcode, sizeof(benchcode) - 1, "=bench")
+        != LUA_OK ||
+      (lua_pushinteger(L, scale), lua_pcall(L, 1, 0, 0)) != LUA_OK) {
+    fprintf(stderr, "%s: %s\n", argv[0], lua_tostring(L, -1));
+    lua_close(L);
+    return EXIT_FAILURE;
+  }
+  lua_close(L);
+  return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,164 @@
+/*
+** $Id: lstress.c $
+** Stress test for states shared among OS threads (LUA_USE_THREADLOCK)
+** See Copyright Notice in lua.h
+*/
+
+#define lstress_c
+
+#include "lprefix.h"
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** Build the library and this program with the thread lock, e.g.:
+**   make clean
+**   make linux lstress MYCFLAGS=-DLUA_USE_THREADLOCK MYLIBS=-lpthread
+** Usage: lstress [nthreads [niterations]]
+*/
+#if !defined(LUA_USE_THREADLOCK)
+#error "lstress needs a library built with LUA_USE_THREADLOCK"
+#endif
+
+
+#define MAXTHREADS	64
+#define DATASIZE	100000
+
+
+/*
+** Code run by each OS thread, in its own Lua thread. It allocates,
+** calls C functions, switches coroutines (whose threads go back to the
+** pool of dead threads), raises errors, and runs GC steps, while all
+** threads read the shared table 'data'. The update of 'counter.n' has
+** no GC check inside, so the lock is not released in the middle of it
+** and no update may be lost.
+*/
+static const char workcode[] =
+  "local id, n = ...\n"
+  "local data, counter, cadd = data, counter, cadd\n"
+  "local size = #data\n"
+  "for i = 1, n do\n"
+  "  local t = {}\n"
+  "  for j = 1, 32 do t[j] = data[(i * 37 + j * id) % size + 1] end\n"
+  "  local s = table.concat(t, ',')\n"
+  "  assert(#s > 0 and string.format('%d:%s', id, t[1]) == id .. ':' .. t[1])\n"
+  "  assert(cadd(i, id) == i + id)\n"
+  "  local co = coroutine.wrap(function (a)\n"
+  "    local b = coroutine.yield(a + 1)\n"
+  "    return b * 2\n"
+  "  end)\n"
+  "  assert(co(i) == i + 1 and co(i) == 2 * i)\n"
+  "  local ok, msg = pcall(error, {i})\n"
+  "  assert(not ok and msg[1] == i)\n"
+  "  if i % 64 == 0 then collectgarbage('step') end\n"
+  "  counter.n = counter.n + 1\n"
+  "end\n";
+
+
+typedef struct Worker {
+  lua_State *L;  /* Lua thread of this worker */
+  int id;
+  int niter;
+  char msg[256];  /* error message ("" if none) */
+  pthread_t thread;
+} Worker;
+
+
+static int cadd (lua_State *L) {
+  lua_pushinteger(L, luaL_checkinteger(L, 1) + luaL_checkinteger(L, 2));
+  return 1;
+}
+
+
+static void *workermain (void *ud) {
+  Worker *w = (Worker *)ud;
+  lua_State *L = w->L;
+  int status = luaL_loadbuffer(L, workcode, sizeof(workcode) - 1, "=work");
+  if (status == LUA_OK) {
+    lua_pushinteger(L, w->id);
+    lua_pushinteger(L, w->niter);
+    status = lua_pcall(L, 2, 0, 0);
+  }
+  if (status != LUA_OK) {
+    const char *msg = lua_tostring(L, -1);
+    snprintf(w->msg, sizeof(w->msg), "%s", msg ? msg : "(no message)");
+    lua_pop(L, 1);
+  }
+  return NULL;
+}
+
+
+int main (int argc, char **argv) {
+  static Worker w[MAXTHREADS];
+  int nthreads = (argc > 1) ? atoi(argv[1]) : 8;
+  int niter = (argc > 2) ? atoi(argv[2]) : 20000;
+  lua_Integer count;
+  int errors = 0;
+  int i;
+  lua_State *L;
+  if (nthreads < 1 || nthreads > MAXTHREADS || niter < 1) {
+    fprintf(stderr, "usage: %s [nthreads (1-%d) [niterations]]\n",
+                    argv[0], MAXTHREADS);
+    return EXIT_FAILURE;
+  }
+  L = luaL_newstate();
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  luaL_openlibs(L);
+  lua_createtable(L, DATASIZE, 0);  /* shared data */
+  for (i = 1; i <= DATASIZE; i++) {
+    lua_pushfstring(L, "v%d", i);
+    lua_rawseti(L, -2, i);
+  }
+  lua_setglobal(L, "data");
+  lua_createtable(L, 0, 1);  /* shared counter */
+  lua_pushinteger(L, 0);
+  lua_setfield(L, -2, "n");
+  lua_setglobal(L, "counter");
+  lua_register(L, "cadd", cadd);
+  for (i = 0; i < nthreads; i++) {
+    w[i].L = lua_newthread(L);  /* anchored in the main stack */
+    w[i].id = i + 1;
+    w[i].niter = niter;
+    w[i].msg[0] = '\0';
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&w[i].thread, NULL, workermain, &w[i]) != 0) {
+      fprintf(stderr, "%s: cannot create thread\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(w[i].thread, NULL);
+    if (w[i].msg[0] != '\0') {
+      fprintf(stderr, "%s: thread %d: %s\n", argv[0], w[i].id, w[i].msg);
+      errors++;
+    }
+  }
+  lua_getglobal(L, "counter");
+  lua_getfield(L, -1, "n");
+  count = lua_tointeger(L, -1);
+  lua_close(L);
+  if (count != (lua_Integer)nthreads * niter) {
+    fprintf(stderr, "%s: counter is " LUA_INTEGER_FMT ", expected %d\n",
+                    argv[0], count, nthreads * niter);
+    errors++;
+  }
+  if (errors > 0)
+    return EXIT_FAILURE;
+  printf("%d threads x %d iterations: ok\n", nthreads, niter);
+  return EXIT_SUCCESS;
+}
+
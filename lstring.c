@@ -25,15 +25,6 @@
 #define MEMERRMSG       "not enough memory"
 
 
-/*
-** Lua will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to
-** compute its hash
-*/
-#if !defined(LUAI_HASHLIMIT)
-#define LUAI_HASHLIMIT		5
-#endif
-
-
 /*
 ** equality for long strings
 */
@@ -46,7 +37,25 @@ int luaS_eqlngstr (TString *a, TString *b) {
 }
 
 
-unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+/*
+** {======================================================
+** Hash functions
+** =======================================================
+*/
+
+/*
+** 'luai_hashstring' computes the hash of a string (of any length)
+** from a seed. You can define it to plug in your own hash function.
+** By default, Lua hashes all bytes of a string, 8 at a time in two
+** independent lanes. Defining LUAI_HASHLIMIT selects the old hash,
+** which uses at most ~(2^LUAI_HASHLIMIT) bytes from each string.
+*/
+#if !defined(luai_hashstring)
+
+#if defined(LUAI_HASHLIMIT)
+
+static unsigned int hashsampled (const char *str, size_t l,
+                                 unsigned int seed) {
   unsigned int h = seed ^ cast(unsigned int, l);
   size_t step = (l >> LUAI_HASHLIMIT) + 1;
   for (; l >= step; l -= step)
@@ -54,6 +63,62 @@ unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   return h;
 }
 
+#define luai_hashstring(s,l,seed)	hashsampled(s,l,seed)
+
+#else
+
+#define rotl32(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+/* mix a 32-bit word 'k' into hash 'h' (MurmurHash3 round) */
+#define hashmix(h,k) \
+  { unsigned int k_ = (k) * 0xcc9e2d51u; \
+    k_ = rotl32(k_, 15) * 0x1b873593u; \
+    h ^= k_; h = rotl32(h, 13) * 5 + 0xe6546b64u; }
+
+
+/* read a 32-bit word from a (possibly unaligned) address */
+static unsigned int getword (const char *s) {
+  unsigned int w;
+  memcpy(&w, s, 4);
+  return w;
+}
+
+
+static unsigned int hashwords (const char *str, size_t l,
+                               unsigned int seed) {
+  unsigned int h1 = seed ^ cast(unsigned int, l);
+  unsigned int h2 = rotl32(h1, 16) ^ 0x9e3779b9u;
+  unsigned int t = 0;
+  for (; l >= 8; l -= 8, str += 8) {  /* two words per step */
+    hashmix(h1, getword(str));
+    hashmix(h2, getword(str + 4));
+  }
+  if (l >= 4) {
+    hashmix(h1, getword(str));
+    l -= 4; str += 4;
+  }
+  while (l > 0)  /* last bytes */
+    t = (t << 8) | cast_byte(str[--l]);
+  hashmix(h2, t);
+  h1 ^= rotl32(h2, 16);
+  h1 ^= h1 >> 16; h1 *= 0x85ebca6bu;  /* final avalanche */
+  h1 ^= h1 >> 13; h1 *= 0xc2b2ae35u;
+  return h1 ^ (h1 >> 16);
+}
+
+#define luai_hashstring(s,l,seed)	hashwords(s,l,seed)
+
+#endif
+
+#endif
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  return luai_hashstring(str, l, seed);
+}
+
+/* }====================================================== */
+
 
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_TLNGSTR);
@@ -66,31 +131,68 @@ unsigned int luaS_hashlongstr (TString *ts) {
 
 
 /*
-** resizes the string table
+** The string table is resized incrementally: 'luaS_resize' only sets
+** up the new bucket array, keeping the old one in 'oldhash', and each
+** call to 'luaS_rehash' moves a few old buckets to the new array. While
+** a resize is in progress, new strings go to the new array and searches
+** look in both. A shrink uses a single array: as sizes are powers of 2,
+** strings in the lower part of the old array are already in their new
+** buckets, so only the upper part is moved; after that, the array is
+** reallocated to its new size (which cannot fail).
 */
-void luaS_resize (lua_State *L, int newsize) {
-  int i;
+
+/* number of old buckets moved for each new string */
+#define REHASHSTEP	4
+
+
+/*
+** moves up to 'n' old buckets to the new array, finishing the resize
+** when there are no more old buckets
+*/
+void luaS_rehash (lua_State *L, int n) {
   stringtable *tb = &G(L)->strt;
-  if (newsize > tb->size) {  /* grow table if needed */
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
-    for (i = tb->size; i < newsize; i++)
-      tb->hash[i] = NULL;
-  }
-  for (i = 0; i < tb->size; i++) {  /* rehash */
-    TString *p = tb->hash[i];
-    tb->hash[i] = NULL;
+  if (!isresizing(tb)) return;  /* nothing to do */
+  for (; n > 0 && tb->migrated < tb->oldsize; n--) {
+    TString *p = tb->oldhash[tb->migrated];
+    tb->oldhash[tb->migrated++] = NULL;
     while (p) {  /* for each node in the list */
       TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, newsize);  /* new position */
+      unsigned int h = lmod(p->hash, tb->size);  /* new position */
       p->u.hnext = tb->hash[h];  /* chain it */
       tb->hash[h] = p;
       p = hnext;
     }
   }
-  if (newsize < tb->size) {  /* shrink table if needed */
-    /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
+  if (tb->migrated == tb->oldsize) {  /* all buckets moved? */
+    if (tb->oldhash != tb->hash)  /* growing? */
+      luaM_freearray(L, tb->oldhash, tb->oldsize);
+    else  /* shrinking; vanishing slice is empty now */
+      luaM_reallocvector(L, tb->hash, tb->oldsize, tb->size, TString *);
+    tb->oldhash = NULL;
+  }
+}
+
+
+/*
+** starts resizing the string table (after finishing any previous resize)
+*/
+void luaS_resize (lua_State *L, int newsize) {
+  stringtable *tb = &G(L)->strt;
+  luaS_rehash(L, MAX_INT);  /* finish previous resize */
+  if (newsize > tb->size) {  /* grow table? */
+    int i;
+    TString **newhash = luaM_newvector(L, newsize, TString *);
+    for (i = 0; i < newsize; i++)
+      newhash[i] = NULL;
+    tb->oldhash = tb->hash;  /* (NULL when creating the table) */
+    tb->oldsize = tb->size;
+    tb->migrated = 0;
+    tb->hash = newhash;
+  }
+  else if (newsize < tb->size) {  /* shrink table? */
+    tb->oldhash = tb->hash;  /* same array */
+    tb->oldsize = tb->size;
+    tb->migrated = newsize;  /* lower part is already in place */
   }
   tb->size = newsize;
 }
@@ -154,6 +256,12 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
   TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  if (isresizing(tb)) {  /* element may be in its old bucket */
+    TString **op = &tb->oldhash[lmod(ts->hash, tb->oldsize)];
+    while (*op != NULL && *op != ts)
+      op = &(*op)->u.hnext;
+    if (*op == ts) p = op;  /* found it there */
+  }
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -161,6 +269,19 @@ void luaS_remove (lua_State *L, TString *ts) {
 }
 
 
+/*
+** search for a short string in list 'ts'
+*/
+static TString *findshrstr (TString *ts, const char *str, size_t l) {
+  for (; ts != NULL; ts = ts->u.hnext) {
+    if (l == ts->shrlen &&
+        (memcmp(str, getstr(ts), l * sizeof(char)) == 0))
+      return ts;  /* found! */
+  }
+  return NULL;
+}
+
+
 /*
 ** checks whether short string exists and reuses it or creates a new one
 */
@@ -170,19 +291,19 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   unsigned int h = luaS_hash(str, l, g->seed);
   TString **list = &g->strt.hash[lmod(h, g->strt.size)];
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
-  for (ts = *list; ts != NULL; ts = ts->u.hnext) {
-    if (l == ts->shrlen &&
-        (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
-      /* found! */
-      if (isdead(g, ts))  /* dead (but not collected yet)? */
-        changewhite(ts);  /* resurrect it */
-      return ts;
-    }
+  ts = findshrstr(*list, str, l);
+  if (ts == NULL && isresizing(&g->strt))  /* try old bucket, too */
+    ts = findshrstr(g->strt.oldhash[lmod(h, g->strt.oldsize)], str, l);
+  if (ts != NULL) {
+    if (isdead(g, ts))  /* dead (but not collected yet)? */
+      changewhite(ts);  /* resurrect it */
+    return ts;
   }
-  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
+  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2)
     luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
-  }
+  else
+    luaS_rehash(L, REHASHSTEP);  /* help pending resize (if any) */
+  list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute (array may change) */
   ts = createstrobj(L, l, LUA_TSHRSTR, h);
   memcpy(getstr(ts), str, l * sizeof(char));
   ts->shrlen = cast_byte(l);
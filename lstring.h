@@ -27,6 +27,12 @@
 #define isreserved(s)	((s)->tt == LUA_TSHRSTR && (s)->extra > 0)
 
 
+/*
+** test whether the string table is being resized
+*/
+#define isresizing(tb)	((tb)->oldhash != NULL)
+
+
 /*
 ** equality for short strings, which are always internalized
 */
@@ -37,6 +43,7 @@ LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
 LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_rehash (lua_State *L, int n);
 LUAI_FUNC void luaS_clearcache (global_State *g);
 LUAI_FUNC void luaS_init (lua_State *L);
 LUAI_FUNC void luaS_remove (lua_State *L, TString *ts);
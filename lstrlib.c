@@ -19,6 +19,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+** The SSE2 paths below can be turned off by defining LUAI_NOSTRSIMD
+** (e.g., to measure the scalar code with 'lstrbench').
+*/
+#if defined(L_STRSSE2) && !defined(LUAI_NOSTRSIMD)
+#define L_STRSSE2
+#include <emmintrin.h>
+#endif
+
 #include "lua.h"
 
 #include "lauxlib.h"
@@ -81,13 +90,130 @@ static int str_sub (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Bulk byte operations
+** =======================================================
+*/
+
+/*
+** With SSE2, the loops below handle 16 bytes per step; the scalar loops
+** do the rest of the string (or all of it without SSE2).
+*/
+
+/* strings shorter than this are mapped byte by byte */
+#define MINBULK		32
+
+
+#if defined(__GNUC__)
+#define firstbit(m)	__builtin_ctz(m)
+#else
+static int firstbit (unsigned int m) {
+  int i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+/* case mapping of the current locale (see 'casemap' below) */
+static const unsigned char *casemap (lua_State *L, int upper);
+
+
+/*
+** Map the 'l' bytes of 's' into 'd' through table 'map' or, if 'map'
+** is NULL, through the ASCII case mapping (of lower-case letters to
+** upper case if 'upper', the other way around otherwise)
+*/
+static void mapcase (char *d, const char *s, size_t l,
+                     const unsigned char *map, int upper) {
+  size_t i = 0;
+  if (map != NULL) {
+    for (; i < l; i++)
+      d[i] = (char)map[uchar(s[i])];
+  }
+  else {
+    int lo = upper ? 'a' : 'A';  /* first letter to be changed */
+#if defined(L_STRSSE2)
+    const __m128i before = _mm_set1_epi8((char)(lo - 1));
+    const __m128i after = _mm_set1_epi8((char)(lo + 26));
+    const __m128i flip = _mm_set1_epi8(0x20);
+    for (; i + 16 <= l; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+      /* (signed) comparisons leave bytes above 127 out of the range */
+      __m128i m = _mm_and_si128(_mm_cmpgt_epi8(v, before),
+                                _mm_cmplt_epi8(v, after));
+      _mm_storeu_si128((__m128i *)(d + i),
+                       _mm_xor_si128(v, _mm_and_si128(m, flip)));
+    }
+#endif
+    for (; i < l; i++) {
+      int c = uchar(s[i]);
+      d[i] = (char)((lo <= c && c < lo + 26) ? c ^ 0x20 : c);
+    }
+  }
+}
+
+
+/* copy the 'l' bytes of 's' into 'd' in reverse order */
+static void reversebytes (char *d, const char *s, size_t l) {
+  size_t i = 0;
+#if defined(L_STRSSE2)
+  for (; i + 16 <= l; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + l - i - 16));
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));  /* 32-bit words */
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));  /* 16-bit words */
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));  /* bytes */
+    _mm_storeu_si128((__m128i *)(d + i), v);
+  }
+#endif
+  for (; i < l; i++)
+    d[i] = s[l - i - 1];
+}
+
+
+#if defined(L_STRSSE2)
+/*
+** Find 's2' ('l2' > 1) in 's1' ('l1' >= 'l2') by testing 16 positions
+** at once for the first and last bytes of 's2'; only positions where
+** both match are compared in full.
+*/
+static const char *simdfind (const char *s1, size_t l1,
+                             const char *s2, size_t l2) {
+  const __m128i first = _mm_set1_epi8(s2[0]);
+  const __m128i last = _mm_set1_epi8(s2[l2 - 1]);
+  size_t n = l1 - l2 + 1;  /* number of positions where 's2' may start */
+  size_t i;
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i *)(s1 + i));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(s1 + i + l2 - 1));
+    unsigned int m = (unsigned int)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+    while (m != 0) {  /* check each candidate */
+      const char *c = s1 + i + firstbit(m);
+      if (memcmp(c + 1, s2 + 1, l2 - 2) == 0)
+        return c;
+      m &= m - 1;  /* clear lowest bit */
+    }
+  }
+  for (; i < n; i++) {
+    if (s1[i] == s2[0] && memcmp(s1 + i + 1, s2 + 1, l2 - 1) == 0)
+      return s1 + i;
+  }
+  return NULL;
+}
+#endif
+
+/* }====================================================== */
+
+
 static int str_reverse (lua_State *L) {
-  size_t l, i;
+  size_t l;
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i = 0; i < l; i++)
-    p[i] = s[l - i - 1];
+  reversebytes(p, s, l);
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -95,12 +221,16 @@ static int str_reverse (lua_State *L) {
 
 static int str_lower (lua_State *L) {
   size_t l;
-  size_t i;
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = tolower(uchar(s[i]));
+  if (l < MINBULK) {  /* not worth a look at the locale? */
+    size_t i;
+    for (i=0; i<l; i++)
+      p[i] = tolower(uchar(s[i]));
+  }
+  else
+    mapcase(p, s, l, casemap(L, 0), 0);
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -108,12 +238,16 @@ static int str_lower (lua_State *L) {
 
 static int str_upper (lua_State *L) {
   size_t l;
-  size_t i;
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = toupper(uchar(s[i]));
+  if (l < MINBULK) {  /* not worth a look at the locale? */
+    size_t i;
+    for (i=0; i<l; i++)
+      p[i] = toupper(uchar(s[i]));
+  }
+  else
+    mapcase(p, s, l, casemap(L, 1), 1);
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -129,16 +263,20 @@ static int str_rep (lua_State *L) {
     return luaL_error(L, "resulting string too large");
   else {
     size_t totallen = (size_t)n * l + (size_t)(n - 1) * lsep;
+    size_t done;  /* bytes already in the result */
     luaL_Buffer b;
     char *p = luaL_buffinitsize(L, &b, totallen);
-    while (n-- > 1) {  /* first n-1 copies (followed by separator) */
-      memcpy(p, s, l * sizeof(char)); p += l;
-      if (lsep > 0) {  /* empty 'memcpy' is not that cheap */
-        memcpy(p, sep, lsep * sizeof(char));
-        p += lsep;
+    memcpy(p, s, l * sizeof(char));  /* first copy */
+    done = l;
+    if (n > 1) {  /* result is 's .. sep' repeated, without the last 'sep' */
+      memcpy(p + l, sep, lsep * sizeof(char));
+      done += lsep;
+      while (done < totallen) {  /* double what is there (or fill up) */
+        size_t m = (done < totallen - done) ? done : totallen - done;
+        memcpy(p + done, p, m * sizeof(char));
+        done += m;
       }
     }
-    memcpy(p, s, l * sizeof(char));  /* last copy (not followed by separator) */
     luaL_pushresultsize(&b, totallen);
   }
   return 1;
@@ -529,6 +667,10 @@ static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
+#if defined(L_STRSSE2)
+  else if (l2 > 1 && l1 - l2 >= 16)  /* worth testing many positions? */
+    return simdfind(s1, l1, s2, l2);
+#endif
   else {
     const char *init;  /* to search for a '*s2' inside 's1' */
     l2--;  /* 1st char will be checked by 'memchr' */
@@ -576,6 +718,598 @@ static int push_captures (MatchState *ms, const char *s, const char *e) {
 }
 
 
+/*
+** Compiled patterns. A pattern is translated into a sequence of items,
+** one per construct, with each single-character class (including
+** bracket classes) expanded to a 256-bit set. 'cmatch' follows 'match'
+** step by step, with the same recursion and the same depth limit, so
+** both always give the same results. Malformed patterns are not
+** compiled: 'match' interprets them and raises its errors exactly where
+** it would raise them.
+*/
+
+/* kinds of pattern items */
+#define PI_SET		0	/* single-character class with optional suffix */
+#define PI_OPEN		1	/* '(' */
+#define PI_POSITION	2	/* '()' */
+#define PI_CLOSE	3	/* ')' */
+#define PI_EOS		4	/* '$' at the end of the pattern */
+#define PI_BALANCE	5	/* '%bxy' */
+#define PI_FRONTIER	6	/* '%f[set]' */
+#define PI_BACKREF	7	/* '%0' - '%9' */
+#define PI_END		8	/* end of pattern */
+
+typedef struct PatItem {
+  unsigned char kind;
+  unsigned char suffix;  /* PI_SET: '*', '+', '-', '?' or 0 */
+  unsigned char nobackoff;  /* PI_SET: '*'/'+' never needs to back off */
+  unsigned char literal;  /* PI_SET: class is the single character 'c1' */
+  unsigned char c1, c2;  /* PI_BALANCE: delimiters; PI_BACKREF: digit */
+  unsigned char set[32];  /* PI_SET, PI_FRONTIER: characters in class */
+} PatItem;
+
+#define inset(set,c)	((set)[(c) >> 3] & (1u << ((c) & 7)))
+
+
+typedef struct CPattern {
+  size_t len;  /* length of pattern text */
+  const char *text;  /* copy of pattern text */
+  unsigned int hash;
+  int first;  /* item where a match must start consuming, or -1 */
+  size_t nlit;  /* length of literal prefix of a match */
+  const char *lit;  /* literal prefix */
+  PatItem item[1];  /* items, ended by PI_END */
+} CPattern;
+
+
+/*
+** Each instance of the library keeps the compiled forms of the patterns
+** it has seen in a set-associative cache, replacing the least recently
+** used entry of a set. The compiled patterns are full userdata kept in
+** the uservalue of the cache (indexed by slot), so that iterators and
+** callbacks can anchor the ones they are using. Classes such as '%a'
+** depend on the locale, so the cache is emptied when 'LC_CTYPE' changes.
+*/
+
+#if !defined(LUAI_PATCACHESETS)
+#define LUAI_PATCACHESETS	16
+#endif
+
+#define PATCACHEWAYS	4
+#define PATCACHESIZE	(LUAI_PATCACHESETS * PATCACHEWAYS)
+
+/* number of hashes of patterns missed once that the cache remembers */
+#define PATSEENSIZE	(4 * PATCACHESIZE)
+
+/* longest locale name that the cache remembers */
+#define LOCNAMESIZE	64
+
+typedef struct PatCache {
+  const CPattern *entry[PATCACHESIZE];
+  unsigned int used[PATCACHESIZE];  /* time of last use of each entry */
+  unsigned int clock;
+  unsigned int seen[PATSEENSIZE];  /* hashes of patterns missed once */
+  unsigned int classok;  /* classes already computed (bit 'cl' - 'a') */
+  unsigned char classes['z' - 'a' + 1][32];  /* sets for '%a', '%c', ... */
+  unsigned char caseok;  /* 'casemaps' computed? */
+  unsigned char asciicase;  /* case mapping is the ASCII one? */
+  unsigned char casemaps[2][UCHAR_MAX + 1];  /* 'tolower', 'toupper' */
+  char locale[LOCNAMESIZE];  /* 'LC_CTYPE' locale of compiled patterns */
+} PatCache;
+
+
+/* like 'classend', but returns NULL for a malformed class */
+static const char *classendx (const char *p, const char *pe) {
+  switch (*p++) {
+    case L_ESC: return (p == pe) ? NULL : p + 1;
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == pe)
+          return NULL;
+        if (*(p++) == L_ESC && p < pe)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p + 1;
+    }
+    default: return p;
+  }
+}
+
+
+#define addchar(set,c)	((set)[(c) >> 3] |= (unsigned char)(1u << ((c) & 7)))
+
+
+/*
+** Add to 'set' the characters matched by '%cl'; return 'cl' if that
+** is just the character itself, -1 for a class like '%a'
+*/
+static int addclass (PatCache *pc, unsigned char *set, int cl) {
+  int lc = tolower(cl);
+  if (lc == 0 || strchr("acdglpsuwxz", lc) == NULL) {
+    addchar(set, cl);
+    return cl;
+  }
+  else {
+    unsigned char *cs = pc->classes[lc - 'a'];
+    int neg = !islower(cl);
+    int i;
+    if (!(pc->classok & (1u << (lc - 'a')))) {  /* not computed yet? */
+      memset(cs, 0, 32);
+      for (i = 0; i <= UCHAR_MAX; i++)
+        if (match_class(i, lc)) addchar(cs, i);
+      pc->classok |= 1u << (lc - 'a');
+    }
+    for (i = 0; i < 32; i++)
+      set[i] |= neg ? (unsigned char)~cs[i] : cs[i];
+    return -1;
+  }
+}
+
+
+/*
+** Fill 'set' with the characters matched by the class 'p' .. 'ep' - 1
+** (following 'singlematch' and 'matchbracketclass'); return the
+** character if the class is a single literal one, -1 otherwise.
+*/
+static int fillset (PatCache *pc, unsigned char *set, const char *p,
+                                                       const char *ep) {
+  memset(set, 0, 32);
+  switch (*p) {
+    case '.': memset(set, 0xff, 32); return -1;
+    case L_ESC: return addclass(pc, set, uchar(*(p + 1)));
+    case '[': {
+      const char *ec = ep - 1;  /* the closing ']' */
+      int sig = 1;
+      int i;
+      if (*(p+1) == '^') {
+        sig = 0;
+        p++;  /* skip the '^' */
+      }
+      while (++p < ec) {
+        if (*p == L_ESC) {
+          p++;
+          addclass(pc, set, uchar(*p));
+        }
+        else if ((*(p+1) == '-') && (p+2 < ec)) {
+          for (i = uchar(*p); i <= uchar(*(p+2)); i++) addchar(set, i);
+          p+=2;
+        }
+        else addchar(set, uchar(*p));
+      }
+      if (!sig)
+        for (i = 0; i < 32; i++) set[i] = (unsigned char)~set[i];
+      return -1;
+    }
+    default: addchar(set, uchar(*p)); return uchar(*p);
+  }
+}
+
+
+static int disjoint (const unsigned char *s1, const unsigned char *s2) {
+  int i;
+  for (i = 0; i < 32; i++)
+    if (s1[i] & s2[i]) return 0;
+  return 1;
+}
+
+
+/*
+** Translate pattern 'p' (with 'lp' bytes) into items, stored in 'item'
+** unless it is NULL. Return the number of items (including the final
+** PI_END), or 0 if the pattern is malformed.
+*/
+static int compilepat (PatCache *pc, const char *p, size_t lp,
+                                     PatItem *item) {
+  const char *pe = p + lp;
+  int n = 0;
+  for (;;) {
+    PatItem it;
+    memset(&it, 0, sizeof(it));
+    if (p == pe) {
+      it.kind = PI_END;
+      if (item) item[n] = it;
+      return n + 1;
+    }
+    switch (*p) {
+      case '(': {
+        if (p + 1 < pe && *(p + 1) == ')') {
+          it.kind = PI_POSITION; p += 2;
+        }
+        else {
+          it.kind = PI_OPEN; p++;
+        }
+        break;
+      }
+      case ')': it.kind = PI_CLOSE; p++; break;
+      case '$': {
+        if (p + 1 != pe) goto dflt;
+        it.kind = PI_EOS; p++;
+        break;
+      }
+      case L_ESC: {
+        if (p + 1 == pe) return 0;  /* ends with '%' */
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= pe - 1) return 0;  /* missing arguments */
+            it.kind = PI_BALANCE;
+            it.c1 = uchar(*(p + 2)); it.c2 = uchar(*(p + 3));
+            p += 4;
+            break;
+          }
+          case 'f': {
+            const char *ep;
+            p += 2;
+            if (p == pe || *p != '[' || (ep = classendx(p, pe)) == NULL)
+              return 0;
+            it.kind = PI_FRONTIER;
+            if (item) fillset(pc, it.set, p, ep);
+            p = ep;
+            break;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            it.kind = PI_BACKREF; it.c1 = uchar(*(p + 1));
+            p += 2;
+            break;
+          }
+          default: goto dflt;
+        }
+        break;
+      }
+      default: dflt: {
+        const char *ep = classendx(p, pe);
+        if (ep == NULL) return 0;
+        it.kind = PI_SET;
+        if (item) {
+          int c = fillset(pc, it.set, p, ep);
+          if (c >= 0) {
+            it.literal = 1; it.c1 = (unsigned char)c;
+          }
+        }
+        if (ep < pe && (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?'))
+          it.suffix = uchar(*ep++);
+        p = ep;
+        break;
+      }
+    }
+    if (item) item[n] = it;
+    n++;
+  }
+}
+
+
+/*
+** Compute the hints used to avoid trying matches: a greedy repetition
+** followed by a class it cannot overlap (or by the end anchor) never
+** has to back off, since every shorter repetition would fail on the
+** next item; and when a match must begin with a given class or literal
+** text, start positions can be searched for.
+*/
+static void analyzepat (CPattern *cp, char *lit) {
+  PatItem *it = cp->item;
+  int i;
+  for (i = 0; it[i].kind != PI_END; i++) {
+    if (it[i].kind == PI_SET && (it[i].suffix == '*' || it[i].suffix == '+'))
+      it[i].nobackoff = (it[i + 1].kind == PI_EOS ||
+                         (it[i + 1].kind == PI_SET &&
+                          (it[i + 1].suffix == 0 || it[i + 1].suffix == '+') &&
+                          disjoint(it[i].set, it[i + 1].set)));
+  }
+  /* skip captures opened before the first character (within limits) */
+  for (i = 0; i < LUA_MAXCAPTURES; i++)
+    if (it[i].kind != PI_OPEN && it[i].kind != PI_POSITION) break;
+  cp->first = -1;
+  cp->nlit = 0;
+  cp->lit = lit;
+  if (it[i].kind == PI_SET && (it[i].suffix == 0 || it[i].suffix == '+')) {
+    cp->first = i;
+    for (; it[i].kind == PI_SET; i++) {  /* collect literal prefix */
+      if (!it[i].literal || (it[i].suffix != 0 && it[i].suffix != '+'))
+        break;
+      lit[cp->nlit++] = (char)it[i].c1;
+      if (it[i].suffix == '+') break;
+    }
+  }
+}
+
+
+/*
+** First position in 's' .. 'e' - 1 where a match of 'cp' may start,
+** or NULL if there is none
+*/
+static const char *skipto (const CPattern *cp, const char *s,
+                                               const char *e) {
+  if (cp->nlit > 0)
+    return lmemfind(s, e - s, cp->lit, cp->nlit);
+  else if (cp->first >= 0) {
+    const unsigned char *set = cp->item[cp->first].set;
+    for (; s < e; s++)
+      if (inset(set, uchar(*s))) return s;
+    return NULL;
+  }
+  else
+    return s;
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s,
+                                           const PatItem *it);
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                                const PatItem *it) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  while (s + i < ms->src_end && inset(it->set, uchar(*(s + i))))
+    i++;
+  if (it->nobackoff)  /* shorter repetitions cannot match? */
+    return cmatch(ms, s + i, it + 1);
+  while (i >= 0) {  /* try with the maximum repetitions, then fewer */
+    const char *res = cmatch(ms, s + i, it + 1);
+    if (res) return res;
+    i--;
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                                const PatItem *it) {
+  for (;;) {
+    const char *res = cmatch(ms, s, it + 1);
+    if (res != NULL)
+      return res;
+    else if (s < ms->src_end && inset(it->set, uchar(*s)))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                   const PatItem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=cmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                 const PatItem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+static const char *cbalance (MatchState *ms, const char *s,
+                                             const PatItem *it) {
+  int cont = 1;
+  if (s >= ms->src_end || uchar(*s) != it->c1) return NULL;
+  while (++s < ms->src_end) {
+    if (uchar(*s) == it->c2) {
+      if (--cont == 0) return s+1;
+    }
+    else if (uchar(*s) == it->c1) cont++;
+  }
+  return NULL;  /* string ends out of balance */
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s,
+                                           const PatItem *it) {
+  if (ms->matchdepth-- == 0)
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto's to optimize tail recursion */
+  switch (it->kind) {
+    case PI_END: break;
+    case PI_OPEN: s = cstart_capture(ms, s, it + 1, CAP_UNFINISHED); break;
+    case PI_POSITION: s = cstart_capture(ms, s, it + 1, CAP_POSITION); break;
+    case PI_CLOSE: s = cend_capture(ms, s, it + 1); break;
+    case PI_EOS: s = (s == ms->src_end) ? s : NULL; break;
+    case PI_BALANCE: {
+      s = cbalance(ms, s, it);
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    case PI_FRONTIER: {
+      int previous = (s == ms->src_init) ? 0 : uchar(*(s - 1));
+      if (!inset(it->set, previous) && inset(it->set, uchar(*s))) {
+        it++; goto init;
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, it->c1);
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    default: {  /* PI_SET */
+      if (!(s < ms->src_end && inset(it->set, uchar(*s)))) {
+        if (it->suffix == '*' || it->suffix == '?' || it->suffix == '-') {
+          it++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (it->suffix) {
+          case '?': {
+            const char *res;
+            if ((res = cmatch(ms, s + 1, it + 1)) != NULL)
+              s = res;
+            else {
+              it++; goto init;
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = cmax_expand(ms, s, it);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = cmin_expand(ms, s, it);
+            break;
+          default:  /* no suffix */
+            s++; it++; goto init;
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+static unsigned int hashpat (const char *p, size_t l) {
+  unsigned int h = (unsigned int)l;
+  for (; l > 0; l--)
+    h ^= ((h << 5) + (h >> 2) + uchar(p[l - 1]));
+  return h;
+}
+
+
+/*
+** Check that the locale did not change since the patterns in the cache
+** were compiled, emptying the cache otherwise. Return 0 if the current
+** locale has a name too long to be remembered (so nothing can be cached).
+*/
+static int checklocale (PatCache *pc) {
+  const char *loc = setlocale(LC_CTYPE, NULL);
+  if (loc == NULL) loc = "";
+  if (strcmp(loc, pc->locale) != 0) {
+    size_t l = strlen(loc);
+    memset(pc->entry, 0, sizeof(pc->entry));
+    pc->classok = 0;
+    pc->caseok = 0;
+    if (l >= LOCNAMESIZE) {
+      pc->locale[0] = '\1';  /* matches no locale name */
+      return 0;
+    }
+    memcpy(pc->locale, loc, l + 1);
+  }
+  return 1;
+}
+
+
+/*
+** Case mapping of the current locale for 'upper' (if 'upper') or
+** 'lower', as a table; NULL when it is the ASCII mapping, which
+** 'mapcase' applies to many bytes at once. The tables live in the
+** pattern cache, which tracks the locale.
+*/
+static const unsigned char *casemap (lua_State *L, int upper) {
+  PatCache *pc = (PatCache *)lua_touserdata(L, lua_upvalueindex(1));
+  checklocale(pc);
+  if (!pc->caseok) {  /* not computed for this locale yet? */
+    int c;
+    pc->asciicase = 1;
+    for (c = 0; c <= UCHAR_MAX; c++) {
+      int lc = ('A' <= c && c <= 'Z') ? c + ('a' - 'A') : c;
+      int uc = ('a' <= c && c <= 'z') ? c - ('a' - 'A') : c;
+      pc->casemaps[0][c] = (unsigned char)tolower(c);
+      pc->casemaps[1][c] = (unsigned char)toupper(c);
+      if (pc->casemaps[0][c] != lc || pc->casemaps[1][c] != uc)
+        pc->asciicase = 0;
+    }
+    pc->caseok = 1;
+  }
+  return pc->asciicase ? NULL : pc->casemaps[upper];
+}
+
+
+static CPattern *newpattern (lua_State *L, PatCache *pc, const char *p,
+                                           size_t lp, int nitems) {
+  size_t isize = (size_t)nitems * sizeof(PatItem);
+  CPattern *cp = (CPattern *)lua_newuserdata(L, offsetof(CPattern, item) +
+                                                isize + 2 * lp + 1);
+  char *text = (char *)cp->item + isize;
+  compilepat(pc, p, lp, cp->item);
+  memcpy(text, p, lp);
+  text[lp] = '\0';
+  cp->len = lp;
+  cp->text = text;
+  analyzepat(cp, text + lp + 1);
+  return cp;
+}
+
+
+/*
+** Get the compiled form of pattern 'p' from the cache (the first
+** upvalue of the library functions), compiling it if needed; when
+** 'anchor' is true, also push it, so that it stays alive while in use
+** even if evicted. Return NULL (pushing nothing) when the pattern is
+** left to the interpreter: if it is malformed, if it cannot be cached,
+** or if it would evict another pattern on its first use (so that
+** patterns used only once do not pay for compilation).
+*/
+static const CPattern *getpattern (lua_State *L, const char *p, size_t lp,
+                                                 int anchor) {
+  PatCache *pc = (PatCache *)lua_touserdata(L, lua_upvalueindex(1));
+  unsigned int h = hashpat(p, lp);
+  int set = (int)(h % LUAI_PATCACHESETS) * PATCACHEWAYS;
+  int i, victim = set;
+  int nitems;
+  CPattern *cp;
+  if (!checklocale(pc))
+    return NULL;
+  for (i = set; i < set + PATCACHEWAYS; i++) {
+    const CPattern *e = pc->entry[i];
+    if (e == NULL) {  /* free entry? (then so are the next ones) */
+      victim = i;
+      break;
+    }
+    if (e->hash == h && e->len == lp && memcmp(e->text, p, lp) == 0) {
+      pc->used[i] = ++pc->clock;
+      if (anchor) {
+        lua_getuservalue(L, lua_upvalueindex(1));
+        lua_rawgeti(L, -1, i + 1);
+        lua_remove(L, -2);
+      }
+      return e;
+    }
+    if (pc->used[i] < pc->used[victim])
+      victim = i;
+  }
+  if (pc->entry[victim] != NULL) {  /* must evict? */
+    unsigned int *seen = &pc->seen[h % PATSEENSIZE];
+    if (*seen != h) {  /* first use of this pattern? */
+      *seen = h;
+      return NULL;
+    }
+  }
+  if ((nitems = compilepat(pc, p, lp, NULL)) == 0)
+    return NULL;  /* malformed pattern */
+  cp = newpattern(L, pc, p, lp, nitems);
+  cp->hash = h;
+  lua_getuservalue(L, lua_upvalueindex(1));
+  lua_pushvalue(L, -2);
+  lua_rawseti(L, -2, victim + 1);  /* anchor it in the cache */
+  lua_pop(L, anchor ? 1 : 2);
+  pc->entry[victim] = cp;
+  pc->used[victim] = ++pc->clock;
+  return cp;
+}
+
+
 /* check whether pattern has no special characters */
 static int nospecials (const char *p, size_t l) {
   size_t upto = 0;
@@ -628,14 +1362,19 @@ static int str_find_aux (lua_State *L, int find) {
     MatchState ms;
     const char *s1 = s + init - 1;
     int anchor = (*p == '^');
+    const CPattern *cp;
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
     prepstate(&ms, L, s, ls, p, lp);
+    cp = getpattern(L, p, lp, 0);
     do {
       const char *res;
+      if (cp != NULL && !anchor && (s1 = skipto(cp, s1, ms.src_end)) == NULL)
+        break;  /* no place left where a match can start */
       reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      res = (cp != NULL) ? cmatch(&ms, s1, cp->item) : match(&ms, s1, p);
+      if (res != NULL) {
         if (find) {
           lua_pushinteger(L, (s1 - s) + 1);  /* start */
           lua_pushinteger(L, res - s);   /* end */
@@ -666,6 +1405,7 @@ typedef struct GMatchState {
   const char *src;  /* current position */
   const char *p;  /* pattern */
   const char *lastmatch;  /* end of last match */
+  const CPattern *cp;  /* compiled pattern (NULL if not compiled) */
   MatchState ms;  /* match state */
 } GMatchState;
 
@@ -676,8 +1416,12 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if (gm->cp != NULL && (src = skipto(gm->cp, src, gm->ms.src_end)) == NULL)
+      break;  /* no place left where a match can start */
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    e = (gm->cp != NULL) ? cmatch(&gm->ms, src, gm->cp->item)
+                         : match(&gm->ms, src, gm->p);
+    if (e != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
     }
@@ -695,7 +1439,9 @@ static int gmatch (lua_State *L) {
   gm = (GMatchState *)lua_newuserdata(L, sizeof(GMatchState));
   prepstate(&gm->ms, L, s, ls, p, lp);
   gm->src = s; gm->p = p; gm->lastmatch = NULL;
-  lua_pushcclosure(L, gmatch_aux, 3);
+  gm->cp = getpattern(L, p, lp, 1);  /* keep it on closure, too */
+  if (gm->cp == NULL) lua_pushnil(L);
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -769,19 +1515,28 @@ static int str_gsub (lua_State *L) {
   int anchor = (*p == '^');
   lua_Integer n = 0;  /* replacement count */
   MatchState ms;
+  const CPattern *cp;
   luaL_Buffer b;
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
-  luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
+  cp = getpattern(L, p, lp, 1);  /* replacements may run Lua code */
+  luaL_buffinit(L, &b);
   prepstate(&ms, L, src, srcl, p, lp);
   while (n < max_s) {
     const char *e;
+    if (cp != NULL && !anchor) {  /* skip places where no match starts */
+      const char *next = skipto(cp, src, ms.src_end);
+      if (next == NULL) break;
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    e = (cp != NULL) ? cmatch(&ms, src, cp->item) : match(&ms, src, p);
+    if (e != NULL && e != lastmatch) {  /* match? */
       n++;
       add_value(&ms, &b, src, e, tr);  /* add replacement to buffer */
       src = lastmatch = e;
@@ -1539,7 +2294,157 @@ static int str_unpack (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+/*
+** A string buffer is a full userdata owning a growable block (allocated
+** with the state's allocator, like the box of a 'luaL_Buffer', and freed
+** by '__gc'). Appending copies only the new bytes, with no intermediate
+** strings, and 'reset' keeps the block for the next use.
+*/
+
+#define LUA_STRBUFHANDLE	"STRBUF*"
+
+typedef struct StrBuf {
+  char *b;  /* contents */
+  size_t n;  /* number of bytes in use */
+  size_t size;  /* size of block 'b' */
+} StrBuf;
+
+
+#define checkstrbuf(L,i)	((StrBuf *)luaL_checkudata(L, i, LUA_STRBUFHANDLE))
+
+
+/*
+** returns a pointer to a free area with at least 'sz' bytes in 'sb'
+*/
+static char *strbufprep (lua_State *L, StrBuf *sb, size_t sz) {
+  if (sb->size - sb->n < sz) {  /* not enough space? */
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    size_t newsize = (sb->size <= MAX_SIZET / 2) ? sb->size * 2 : MAX_SIZET;
+    char *temp;
+    if (MAX_SIZET - sz < sb->n)  /* overflow? */
+      luaL_error(L, "buffer too large");
+    if (newsize < sb->n + sz)  /* double is not big enough? */
+      newsize = sb->n + sz;
+    if (newsize < LUAL_BUFFERSIZE)
+      newsize = LUAL_BUFFERSIZE;
+    temp = (char *)allocf(ud, sb->b, sb->size, newsize);
+    if (temp == NULL)  /* allocation error? (old block is still valid) */
+      luaL_error(L, "not enough memory for buffer allocation");
+    sb->b = temp;
+    sb->size = newsize;
+  }
+  return sb->b + sb->n;
+}
+
+
+/*
+** string.buffer([size]): new empty buffer with room for 'size' bytes
+*/
+static int strbuf_new (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  StrBuf *sb;
+  luaL_argcheck(L, 0 <= size && (lua_Unsigned)size <= MAXSIZE, 1,
+                   "invalid size");
+  sb = (StrBuf *)lua_newuserdata(L, sizeof(StrBuf));
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_setmetatable(L, LUA_STRBUFHANDLE);
+  if (size > 0)
+    strbufprep(L, sb, (size_t)size);
+  return 1;
+}
+
+
+/*
+** b:put(...): append the arguments (strings, numbers or buffers) to
+** 'b'; returns 'b'
+*/
+static int strbuf_put (lua_State *L) {
+  StrBuf *sb = checkstrbuf(L, 1);
+  int i;
+  int n = lua_gettop(L);
+  for (i = 2; i <= n; i++) {
+    StrBuf *other = (StrBuf *)luaL_testudata(L, i, LUA_STRBUFHANDLE);
+    size_t l;
+    const char *s;
+    if (other != NULL) {  /* another buffer? */
+      s = other->b; l = other->n;
+      if (l > 0 && other == sb) {  /* appending 'b' to itself? */
+        char *p = strbufprep(L, sb, l);  /* may move 'sb->b' */
+        memcpy(p, sb->b, l);
+        sb->n += l;
+        continue;
+      }
+    }
+    else
+      s = luaL_checklstring(L, i, &l);
+    if (l > 0) {
+      memcpy(strbufprep(L, sb, l), s, l);
+      sb->n += l;
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int strbuf_tostring (lua_State *L) {
+  StrBuf *sb = checkstrbuf(L, 1);
+  lua_pushlstring(L, (sb->n > 0) ? sb->b : "", sb->n);
+  return 1;
+}
+
+
+/*
+** b:reset(): empty 'b', keeping its memory; returns 'b'
+*/
+static int strbuf_reset (lua_State *L) {
+  checkstrbuf(L, 1)->n = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int strbuf_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)checkstrbuf(L, 1)->n);
+  return 1;
+}
+
+
+static int strbuf_gc (lua_State *L) {
+  StrBuf *sb = checkstrbuf(L, 1);
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  allocf(ud, sb->b, sb->size, 0);
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  return 0;
+}
+
+
+/* methods and metamethods for string buffers */
+static const luaL_Reg strbuf_meta[] = {
+  {"put", strbuf_put},
+  {"reset", strbuf_reset},
+  {"tostring", strbuf_tostring},
+  {"__tostring", strbuf_tostring},
+  {"__len", strbuf_len},
+  {"__gc", strbuf_gc},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
 static const luaL_Reg strlib[] = {
+  {"buffer", strbuf_new},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
@@ -1573,12 +2478,26 @@ static void createmetatable (lua_State *L) {
 }
 
 
+static void createstrbufmeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_STRBUFHANDLE);  /* metatable for buffers */
+  luaL_setfuncs(L, strbuf_meta, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+
 /*
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
-  luaL_newlib(L, strlib);
+  luaL_newlibtable(L, strlib);
+  memset(lua_newuserdata(L, sizeof(PatCache)), 0, sizeof(PatCache));
+  lua_createtable(L, PATCACHESIZE, 0);  /* compiled patterns by slot */
+  lua_setuservalue(L, -2);
+  luaL_setfuncs(L, strlib, 1);  /* pattern cache is upvalue of all */
   createmetatable(L);
+  createstrbufmeta(L);
   return 1;
 }
 
@@ -21,10 +21,17 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** (With LUA_USE_SWISSTABLE, the hash part is an open-addressing table
+** instead; see "Swiss-table hash part" below.)
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
+
+#if LUA_USE_SWISSTABLE && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "lua.h"
 
@@ -72,6 +79,8 @@
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
 
 
+#if !LUA_USE_SWISSTABLE
+
 #define dummynode		(&dummynode_)
 
 static const Node dummynode_ = {
@@ -79,6 +88,11 @@ static const Node dummynode_ = {
   {{NILCONSTANT, 0}}  /* key */
 };
 
+/* size in bytes of a node array with 'size' nodes */
+#define nodebytes(size)		(cast(size_t, size) * sizeof(Node))
+
+#endif
+
 
 /*
 ** Hash for floating-point numbers.
@@ -110,6 +124,8 @@ static int l_hashfloat (lua_Number n) {
 #endif
 
 
+#if !LUA_USE_SWISSTABLE
+
 /*
 ** returns the 'main' position of an element in a table (that is, the index
 ** of its hash value)
@@ -136,6 +152,205 @@ static Node *mainposition (const Table *t, const TValue *key) {
   }
 }
 
+#endif
+
+
+/*
+** {=============================================================
+** Swiss-table hash part
+** ==============================================================
+*/
+
+#if LUA_USE_SWISSTABLE
+
+/*
+** The hash part is an open-addressing table. Besides the nodes, it has
+** one control byte per node, stored right after the node array: either
+** CTRL_EMPTY, for a node never used, or the low 7 bits of the hash of
+** the node's key. Nodes are probed in groups of GROUPW consecutive
+** nodes; one comparison of the group's control bytes selects the few
+** nodes whose keys must be checked, and a group with an empty node ends
+** the search. Groups are probed in triangular order, which visits all
+** of them. Keys are never removed from the hash part (only their values
+** become nil), so there are no tombstones; when a table runs out of
+** empty nodes, a new key can take a node with a nil value. Node arrays
+** smaller than a group pad their control bytes with CTRL_PAD, which
+** matches nothing.
+*/
+
+#if defined(__SSE2__)
+
+#define GROUPW		16
+
+/* bit mask of the bytes in group 'g' equal to 'b' */
+#define matchbyte(g,b)	cast(unsigned int, _mm_movemask_epi8(_mm_cmpeq_epi8( \
+	_mm_loadu_si128(cast(const __m128i *, (g))), \
+	_mm_set1_epi8(cast(char, (b))))))
+
+#else
+
+#define GROUPW		8
+
+/* bit mask of the bytes in group 'g' equal to 'b' */
+static unsigned int matchbyte (const lu_byte *g, int b) {
+  unsigned int m = 0;
+  int i;
+  for (i = 0; i < GROUPW; i++) {
+    if (g[i] == b) m |= 1u << i;
+  }
+  return m;
+}
+
+#endif
+
+
+#if defined(__GNUC__)
+#define firstbit(m)	__builtin_ctz(m)
+#else
+static int firstbit (unsigned int m) {
+  int i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+#define CTRL_EMPTY	0x80
+#define CTRL_PAD	0xFE
+
+#define h2(h)		cast_byte((h) & 0x7f)
+
+/* control bytes of table 't' */
+#define gctrl(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/* number of control bytes for a node array with 'size' nodes */
+#define ctrlsize(size)	((size) < GROUPW ? GROUPW : (size))
+
+/* size in bytes of a node array with 'size' nodes (plus control bytes) */
+#define nodebytes(size)	(cast(size_t, size) * sizeof(Node) + ctrlsize(size))
+
+#define ngroups(t)	(sizenode(t) < GROUPW ? 1 : sizenode(t) / GROUPW)
+
+/* maximum number of keys in a node array with 'size' nodes */
+#define maxload(size)	((size) - (size) / 8)
+
+
+/*
+** The dummy node needs its control bytes, too: all empty. (16 is the
+** largest GROUPW.)
+*/
+static const struct {
+  Node node;
+  lu_byte ctrl[16];
+} dummy_ = {
+  {{NILCONSTANT}, {{NILCONSTANT, 0}}},
+  {CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+   CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+   CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+   CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY}
+};
+
+#define dummynode		(&dummy_.node)
+
+
+/*
+** Raw hashes are spread over all bits, as the group index comes from
+** the high bits and the control byte from the low ones.
+*/
+static unsigned int mixhash (unsigned int h) {
+  h *= 0x9e3779b1u;
+  return h ^ (h >> 15);
+}
+
+#define inthash(i)	(cast(unsigned int, l_castS2U(i) ^ (l_castS2U(i) >> 31 >> 1)))
+
+
+static unsigned int keyhash (const TValue *key) {
+  switch (ttype(key)) {
+    case LUA_TNUMINT:
+      return mixhash(inthash(ivalue(key)));
+    case LUA_TNUMFLT:
+      return mixhash(cast(unsigned int, l_hashfloat(fltvalue(key))));
+    case LUA_TSHRSTR:
+      return mixhash(tsvalue(key)->hash);
+    case LUA_TLNGSTR:
+      return mixhash(luaS_hashlongstr(tsvalue(key)));
+    case LUA_TBOOLEAN:
+      return mixhash(cast(unsigned int, bvalue(key)));
+    case LUA_TLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case LUA_TLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      lua_assert(!ttisdeadkey(key));
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+
+/*
+** Search the probe sequence of hash 'h' in table 't' for a node 'n'
+** whose key satisfies 'cond'; 'n' ends as NULL if there is none.
+*/
+#define swisssearch(t,h,n,cond) {  \
+  const lu_byte *ctrl_ = gctrl(t);  \
+  unsigned int mask_ = ngroups(t) - 1;  \
+  unsigned int g_ = ((h) >> 7) & mask_;  \
+  unsigned int i_ = 0;  \
+  for (;;) {  \
+    const lu_byte *grp_ = ctrl_ + g_ * GROUPW;  \
+    unsigned int m_ = matchbyte(grp_, h2(h));  \
+    for (; m_ != 0; m_ &= m_ - 1) {  \
+      n = gnode(t, g_ * GROUPW + firstbit(m_));  \
+      if (cond) break;  \
+    }  \
+    if (m_ != 0) break;  /* found it */  \
+    if (matchbyte(grp_, CTRL_EMPTY) != 0 || i_++ == mask_) {  \
+      n = NULL;  /* not found */  \
+      break;  \
+    }  \
+    g_ = (g_ + i_) & mask_;  /* next group */  \
+  } }
+
+
+/*
+** Find a node for a new key with hash 'h': the first empty node in its
+** probe sequence or, if the table has no room left for new keys, a node
+** with a nil value before that. Return NULL if there is none.
+*/
+static Node *swissfreepos (Table *t, unsigned int h) {
+  lu_byte *ctrl = gctrl(t);
+  unsigned int mask = ngroups(t) - 1;
+  unsigned int g = (h >> 7) & mask;
+  unsigned int i = 0;
+  for (;;) {
+    lu_byte *grp = ctrl + g * GROUPW;
+    unsigned int m = matchbyte(grp, CTRL_EMPTY);
+    int j;
+    if (t->growthleft == 0) {  /* no room? look for a dead node */
+      for (j = 0; j < GROUPW; j++) {
+        if (grp[j] < CTRL_EMPTY && ttisnil(gval(gnode(t, g * GROUPW + j)))) {
+          grp[j] = h2(h);
+          return gnode(t, g * GROUPW + j);
+        }
+      }
+      if (m != 0) return NULL;  /* no dead nodes in this sequence */
+    }
+    else if (m != 0) {  /* use first empty node */
+      j = firstbit(m);
+      grp[j] = h2(h);
+      t->growthleft--;
+      return gnode(t, g * GROUPW + j);
+    }
+    if (i++ == mask) return NULL;  /* tried all groups */
+    g = (g + i) & mask;
+  }
+}
+
+#endif
+
+/* }============================================================= */
+
 
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
@@ -163,6 +378,23 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
   else {
+#if LUA_USE_SWISSTABLE
+    Node *n;
+    unsigned int h = keyhash(key);
+    swisssearch(t, h, n, luaV_rawequalobj(gkey(n), key));
+    if (n == NULL && iscollectable(key)) {
+      /* key may be dead already, but it is ok to use it in 'next'. (Look
+         for it only now: the address of a collected key may have been
+         reused by a live key, which must win.) */
+      swisssearch(t, h, n, ttisdeadkey(gkey(n)) &&
+                           deadvalue(gkey(n)) == gcvalue(key));
+    }
+    if (n == NULL)
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    i = cast_int(n - gnode(t, 0));  /* key index in hash table */
+    /* hash elements are numbered after array ones */
+    return (i + 1) + t->sizearray;
+#else
     int nx;
     Node *n = mainposition(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -179,6 +411,7 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
         luaG_runerror(L, "invalid key to 'next'");  /* key not found */
       else n += nx;
     }
+#endif
   }
 }
 
@@ -296,36 +529,189 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 }
 
 
+/*
+** {=============================================================
+** Cache of free vectors
+** ==============================================================
+*/
+
+/*
+** Tables that keep growing and shrinking (or being created and
+** collected) would call the allocator for each change; instead, freed
+** vectors with a power-of-2 size go to a cache in the global state.
+** Cached memory does not count as in use (as with the thread pool).
+*/
+
+#define nextfree(v)	(*cast(void **, (v)))
+
+
+/* cache bin for a vector with 'size' elements, or -1 if none */
+static int cachebin (unsigned int size) {
+  if (size == 0 || (size & (size - 1)) != 0)  /* not a power of 2? */
+    return -1;
+  else {
+    int b = luaO_ceillog2(size);
+    return (b <= TCACHEBITS) ? b : -1;
+  }
+}
+
+
+/* take a vector from bin 'b' of cache 'c' (NULL if none) */
+static void *cacheget (global_State *g, VecCache *c, int b, size_t bytes) {
+  void *v = c->bin[b];
+  if (v != NULL) {
+    c->bin[b] = nextfree(v);
+    c->n[b]--;
+    g->GCdebt += bytes;  /* as if just allocated */
+  }
+  return v;
+}
+
+
+/* put vector 'v' in bin 'b' of cache 'c'; return false if it is full */
+static int cacheput (global_State *g, VecCache *c, int b, void *v,
+                     size_t bytes) {
+  if (b < 0 || c->n[b] >= TCACHEMAX)
+    return 0;
+  nextfree(v) = c->bin[b];
+  c->bin[b] = v;
+  c->n[b]++;
+  g->GCdebt -= bytes;  /* as if freed */
+  return 1;
+}
+
+
+static void trimvectors (lua_State *L, VecCache *c, int isnode) {
+  int b;
+  for (b = 0; b <= TCACHEBITS; b++) {
+    size_t bytes = isnode ? nodebytes(twoto(b)) : sizeof(TValue) * twoto(b);
+    while (c->bin[b] != NULL) {
+      void *v = cacheget(G(L), c, b, bytes);
+      luaM_freemem(L, v, bytes);
+    }
+  }
+}
+
+
+/*
+** free all cached vectors (called at the end of GC cycles)
+*/
+void luaH_trimcache (lua_State *L) {
+  trimvectors(L, &G(L)->nodecache, 1);
+  trimvectors(L, &G(L)->arraycache, 0);
+}
+
+
+static void freenodevector (lua_State *L, Node *n, int size) {
+  if (!cacheput(G(L), &G(L)->nodecache, cachebin(size), n, nodebytes(size)))
+    luaM_freemem(L, n, nodebytes(size));
+}
+
+
+/*
+** Change the array part of 't' from 'oldsize' to 'size' elements,
+** keeping the first ones. (Unlike 'setarrayvector', it does not
+** change 'sizearray' nor clear new slots.) A shrink never allocates:
+** 'luaH_resize' shrinks the array while the old hash part is reachable
+** only from a local, so a collection (or an error) there would free
+** (or leak) its entries. (A shrink to 0, as in 'luaH_free', needs no
+** new vector, so the old one can still go to the cache.)
+*/
+static void reallocarray (lua_State *L, Table *t, unsigned int oldsize,
+                                                  unsigned int size) {
+  global_State *g = G(L);
+  int oldbin = cachebin(oldsize);
+  int bin = cachebin(size);
+  TValue *v = NULL;
+  if (bin >= 0)
+    v = cast(TValue *, cacheget(g, &g->arraycache, bin,
+                                sizeof(TValue) * size));
+  if (v == NULL && (oldbin < 0 || (size > 0 && size < oldsize)))
+    luaM_reallocvector(L, t->array, oldsize, size, TValue);
+  else {
+    if (v == NULL && size > 0)
+      v = luaM_newvector(L, size, TValue);
+    if (oldsize > 0) {
+      if (size > 0)
+        memcpy(v, t->array, sizeof(TValue) * (size < oldsize ? size : oldsize));
+      if (!cacheput(g, &g->arraycache, oldbin, t->array,
+                    sizeof(TValue) * oldsize))
+        luaM_freearray(L, t->array, oldsize);
+    }
+    t->array = v;
+  }
+}
+
+/* }============================================================= */
+
+
 static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
   unsigned int i;
-  luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
+  reallocarray(L, t, t->sizearray, size);
   for (i=t->sizearray; i<size; i++)
      setnilvalue(&t->array[i]);
   t->sizearray = size;
 }
 
 
+/*
+** make all nodes of a (non-dummy) hash part free
+*/
+static void clearnodes (Table *t) {
+  int i;
+  int size = sizenode(t);
+  for (i = 0; i < size; i++) {
+    Node *n = gnode(t, i);
+    gnext(n) = 0;
+    setnilvalue(wgkey(n));
+    setnilvalue(gval(n));
+  }
+  t->lastfree = gnode(t, size);  /* all positions are free */
+#if LUA_USE_SWISSTABLE
+  memset(gctrl(t), CTRL_EMPTY, size);
+  t->growthleft = maxload(size);
+#endif
+}
+
+
 static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
     t->lsizenode = 0;
     t->lastfree = NULL;  /* signal that it is using dummy node */
+#if LUA_USE_SWISSTABLE
+    t->growthleft = 0;  /* no room for new keys */
+#endif
   }
   else {
-    int i;
+    Node *n = NULL;
     int lsize = luaO_ceillog2(size);
+#if LUA_USE_SWISSTABLE
+    if (cast(unsigned int, maxload(twoto(lsize))) < size)  /* too crowded? */
+      lsize++;
+#endif
     if (lsize > MAXHBITS)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = luaM_newvector(L, size, Node);
-    for (i = 0; i < (int)size; i++) {
-      Node *n = gnode(t, i);
-      gnext(n) = 0;
-      setnilvalue(wgkey(n));
-      setnilvalue(gval(n));
+    if (lsize <= TCACHEBITS)  /* try a cached vector */
+      n = cast(Node *, cacheget(G(L), &G(L)->nodecache, lsize,
+                                nodebytes(size)));
+    if (n == NULL) {  /* (allocation may collect: 't' must stay valid) */
+#if LUA_USE_SWISSTABLE
+      if (sizeof(size) >= sizeof(size_t) &&
+          cast(size_t, size) + 1 > (MAX_SIZET - GROUPW) / sizeof(Node))
+        luaM_toobig(L);
+      n = cast(Node *, luaM_malloc(L, nodebytes(size)));
+#else
+      n = luaM_newvector(L, size, Node);
+#endif
     }
+    t->node = n;
     t->lsizenode = cast_byte(lsize);
-    t->lastfree = gnode(t, size);  /* all positions are free */
+#if LUA_USE_SWISSTABLE
+    memset(gctrl(t) + size, CTRL_PAD, ctrlsize(size) - size);
+#endif
+    clearnodes(t);
   }
 }
 
@@ -349,7 +735,7 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
         luaH_setint(L, t, i + 1, &t->array[i]);
     }
     /* shrink array */
-    luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
+    reallocarray(L, t, oldasize, nasize);
   }
   /* re-insert elements from hash part */
   for (j = oldhsize - 1; j >= 0; j--) {
@@ -361,15 +747,37 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
     }
   }
   if (oldhsize > 0)  /* not the dummy node? */
-    luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+    freenodevector(L, nold, oldhsize);  /* free old hash */
 }
 
 
 void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
+#if LUA_USE_SWISSTABLE
+  int nsize = isdummy(t) ? 0 : maxload(sizenode(t));  /* keep node size */
+#else
   int nsize = allocsizenode(t);
+#endif
   luaH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** Return the array slots for keys 'start' to 'start + n - 1' (n > 0),
+** first growing the array part if the range extends it without a gap;
+** return NULL if the range cannot live in the array part.
+*/
+TValue *luaH_arrayrange (lua_State *L, Table *t, lua_Integer start, int n) {
+  lua_Unsigned end;  /* last key in the range */
+  if (start < 1 || l_castS2U(start) - 1u > t->sizearray)
+    return NULL;  /* range does not start inside or right after array */
+  end = l_castS2U(start) - 1u + cast(unsigned int, n);
+  if (end > MAXASIZE)
+    return NULL;
+  if (end > t->sizearray)
+    luaH_resizearray(L, t, cast(unsigned int, end));
+  return &t->array[start - 1];
+}
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -411,14 +819,36 @@ Table *luaH_new (lua_State *L) {
 }
 
 
+/*
+** remove all entries from table 't', keeping its array and hash parts
+** (so that it can be refilled without being resized). As with assigning
+** nil to each field, only the values are cleared: keys stay in place
+** (the collector removes the dead ones), so that 'next' still works
+** over a table cleared during its traversal.
+*/
+void luaH_clear (Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (!isdummy(t)) {
+    int j;
+    for (j = 0; j < sizenode(t); j++)
+      setnilvalue(gval(gnode(t, j)));
+  }
+}
+
+
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t))
-    luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
-  luaM_freearray(L, t->array, t->sizearray);
+    freenodevector(L, t->node, sizenode(t));
+  if (t->sizearray > 0)
+    reallocarray(L, t, t->sizearray, 0);
   luaM_free(L, t);
 }
 
 
+#if !LUA_USE_SWISSTABLE
+
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -430,6 +860,8 @@ static Node *getfreepos (Table *t) {
   return NULL;  /* could not find a free place */
 }
 
+#endif
+
 
 
 /*
@@ -452,6 +884,14 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
     else if (luai_numisnan(fltvalue(key)))
       luaG_runerror(L, "table index is NaN");
   }
+#if LUA_USE_SWISSTABLE
+  mp = swissfreepos(t, keyhash(key));
+  if (mp == NULL) {  /* cannot find a free place? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+#else
   mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
@@ -484,6 +924,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       mp = f;
     }
   }
+#endif
   setnodekey(L, &mp->i_key, key);
   luaC_barrierback(L, t, key);
   lua_assert(ttisnil(gval(mp)));
@@ -499,6 +940,12 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
   if (l_castS2U(key) - 1 < t->sizearray)
     return &t->array[key - 1];
   else {
+#if LUA_USE_SWISSTABLE
+    Node *n;
+    swisssearch(t, mixhash(inthash(key)), n,
+                ttisinteger(gkey(n)) && ivalue(gkey(n)) == key);
+    return (n != NULL) ? gval(n) : luaO_nilobject;
+#else
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
@@ -510,6 +957,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
       }
     }
     return luaO_nilobject;
+#endif
   }
 }
 
@@ -518,6 +966,13 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
+#if LUA_USE_SWISSTABLE
+  Node *n;
+  lua_assert(key->tt == LUA_TSHRSTR);
+  swisssearch(t, mixhash(key->hash), n,
+              ttisshrstring(gkey(n)) && eqshrstr(tsvalue(gkey(n)), key));
+  return (n != NULL) ? gval(n) : luaO_nilobject;
+#else
   Node *n = hashstr(t, key);
   lua_assert(key->tt == LUA_TSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -531,6 +986,19 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
       n += nx;
     }
   }
+#endif
+}
+
+
+/*
+** search function for short strings, updating inline cache 'c' (see
+** 'luaH_getshortstrcached')
+*/
+const TValue *luaH_getshortstrc (Table *t, TString *key, unsigned int *c) {
+  const TValue *v = luaH_getshortstr(t, key);
+  if (v != luaO_nilobject)  /* found key? */
+    *c = cast(unsigned int, cast(const Node *, v) - gnode(t, 0));
+  return v;
 }
 
 
@@ -539,6 +1007,11 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
+#if LUA_USE_SWISSTABLE
+  Node *n;
+  swisssearch(t, keyhash(key), n, luaV_rawequalobj(gkey(n), key));
+  return (n != NULL) ? gval(n) : luaO_nilobject;
+#else
   Node *n = mainposition(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (luaV_rawequalobj(gkey(n), key))
@@ -550,6 +1023,7 @@ static const TValue *getgeneric (Table *t, const TValue *key) {
       n += nx;
     }
   }
+#endif
 }
 
 
@@ -658,10 +1132,233 @@ int luaH_getn (Table *t) {
 
 
 
+/*
+** {=============================================================
+** Sorting of array parts
+** ==============================================================
+*/
+
+/* ranges up to this size are sorted by insertion */
+#define SORTCUT		12
+
+#define swapobj(L,a,b)	{ TValue t_; setobj(L, &t_, a); setobj(L, a, b); \
+                          setobj(L, b, &t_); }
+
+#define ltint(L,a,b)	(ivalue(a) < ivalue(b))
+#define ltflt(L,a,b)	luai_numlt(fltvalue(a), fltvalue(b))
+#define ltgen(L,a,b)	luaV_lessthan(L, a, b)
+
+/*
+** Introsort over 'a[0 .. n-1]': quicksort with a median-of-three pivot,
+** switching to heapsort when the recursion gets too deep and to
+** insertion sort for short ranges. 'LT' must be a strict weak order that
+** neither raises errors nor allocates memory.
+*/
+#define DEFSORT(N,LT) \
+static void insort_##N (lua_State *L, TValue *a, unsigned int n) { \
+  unsigned int i, j; \
+  for (i = 1; i < n; i++) { \
+    TValue v; \
+    setobj(L, &v, &a[i]); \
+    for (j = i; j > 0 && LT(L, &v, &a[j - 1]); j--) \
+      setobj(L, &a[j], &a[j - 1]); \
+    setobj(L, &a[j], &v); \
+  } \
+} \
+static void sift_##N (lua_State *L, TValue *a, unsigned int i, \
+                                                unsigned int n) { \
+  unsigned int c; \
+  while ((c = 2 * i + 1) < n) { \
+    if (c + 1 < n && LT(L, &a[c], &a[c + 1])) c++; \
+    if (!LT(L, &a[i], &a[c])) break; \
+    swapobj(L, &a[i], &a[c]); \
+    i = c; \
+  } \
+} \
+static void heapsort_##N (lua_State *L, TValue *a, unsigned int n) { \
+  unsigned int i; \
+  for (i = n / 2; i-- > 0; ) sift_##N(L, a, i, n); \
+  while (n > 1) { \
+    n--; \
+    swapobj(L, &a[0], &a[n]); \
+    sift_##N(L, a, 0, n); \
+  } \
+} \
+static void introsort_##N (lua_State *L, TValue *a, unsigned int n, \
+                                                    int depth) { \
+  while (n > SORTCUT) { \
+    unsigned int i, j, m = n / 2; \
+    if (depth-- == 0) { heapsort_##N(L, a, n); return; } \
+    if (LT(L, &a[m], &a[0])) swapobj(L, &a[m], &a[0]); \
+    if (LT(L, &a[n - 1], &a[m])) { \
+      swapobj(L, &a[n - 1], &a[m]); \
+      if (LT(L, &a[m], &a[0])) swapobj(L, &a[m], &a[0]); \
+    } \
+    /* a[0] <= a[m] <= a[n - 1]; the ends bound the scans below */ \
+    swapobj(L, &a[1], &a[m]);  /* pivot goes to a[1] */ \
+    i = 1; j = n - 1; \
+    for (;;) { \
+      while (LT(L, &a[++i], &a[1])) ; \
+      while (LT(L, &a[1], &a[--j])) ; \
+      if (j < i) break; \
+      swapobj(L, &a[i], &a[j]); \
+    } \
+    swapobj(L, &a[1], &a[j]); \
+    /* a[0 .. j - 1] <= a[j] <= a[j + 1 .. n - 1] */ \
+    if (j < n - j - 1) {  /* recurse into the smaller part */ \
+      introsort_##N(L, a, j, depth); \
+      a += j + 1; n -= j + 1; \
+    } \
+    else { \
+      introsort_##N(L, a + j + 1, n - j - 1, depth); \
+      n = j; \
+    } \
+  } \
+  insort_##N(L, a, n); \
+}
+
+DEFSORT(int, ltint)
+DEFSORT(flt, ltflt)
+DEFSORT(gen, ltgen)
+
+
+/* a value with its sort key, for sorts by key */
+typedef struct SortPair {
+  TValue k;
+  TValue v;
+} SortPair;
+
+/*
+** Stable merge sort of 'a[0 .. n-1]' by key, using 'w' (room for n/2
+** pairs) as scratch. Halves that are already in order are not merged,
+** so (nearly) sorted input takes (nearly) linear time.
+*/
+#define DEFMSORT(N,LT) \
+static void msort_##N (lua_State *L, SortPair *a, unsigned int n, \
+                                                  SortPair *w) { \
+  unsigned int i, j, m, o; \
+  if (n <= SORTCUT) {  /* insertion sort; stable with a strict '<' */ \
+    for (i = 1; i < n; i++) { \
+      SortPair p = a[i]; \
+      for (j = i; j > 0 && LT(L, &p.k, &a[j - 1].k); j--) \
+        a[j] = a[j - 1]; \
+      a[j] = p; \
+    } \
+    return; \
+  } \
+  m = n / 2; \
+  msort_##N(L, a, m, w); \
+  msort_##N(L, a + m, n - m, w); \
+  if (!LT(L, &a[m].k, &a[m - 1].k)) \
+    return;  /* halves already in order */ \
+  memcpy(w, a, m * sizeof(SortPair)); \
+  for (i = 0, j = m, o = 0; i < m && j < n; o++) \
+    a[o] = LT(L, &a[j].k, &w[i].k) ? a[j++] : w[i++]; \
+  while (i < m) a[o++] = w[i++];  /* rest of the right half is in place */ \
+}
+
+DEFMSORT(int, ltint)
+DEFMSORT(flt, ltflt)
+DEFMSORT(gen, ltgen)
+
+
+#define SORTINT		1	/* only integers */
+#define SORTFLT		2	/* only floats */
+#define SORTGEN		3	/* numbers of both kinds, or only strings */
+
+/*
+** Which instance of the sorts above can order 'a[0 .. n-1]', or 0 if
+** those values are not all numbers (without NaN) or all strings
+*/
+static int sortkind (const TValue *a, unsigned int n) {
+  int seen = 0;  /* bit 0: integers; bit 1: floats; bit 2: strings */
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    switch (ttype(&a[i])) {
+      case LUA_TNUMINT: seen |= 1; break;
+      case LUA_TNUMFLT: {
+        if (luai_numisnan(fltvalue(&a[i])))
+          return 0;  /* NaN has no place in the order */
+        seen |= 2;
+        break;
+      }
+      case LUA_TSHRSTR: case LUA_TLNGSTR: seen |= 4; break;
+      default: return 0;
+    }
+  }
+  if ((seen & 4) && (seen & 3))
+    return 0;  /* numbers and strings are not comparable */
+  return (seen == 1) ? SORTINT : (seen == 2) ? SORTFLT : SORTGEN;
+}
+
+
+/*
+** Sort 't[1 .. n]' in ascending order, all in the array part, when its
+** values are all numbers (no NaN) or all strings, comparing them without
+** going through the API. Return 0 (with the table untouched) for any
+** other contents, so that the caller can use the generic sort. Values
+** only move inside the array, so no barrier is needed.
+*/
+int luaH_sortarray (lua_State *L, Table *t, unsigned int n) {
+  int kind, depth = 0;
+  unsigned int i;
+  lua_assert(n <= t->sizearray);
+  kind = sortkind(t->array, n);
+  if (kind == 0)
+    return 0;
+  for (i = n; i > 1; i >>= 1) depth += 2;  /* 2 * log2(n) */
+  switch (kind) {
+    case SORTINT: introsort_int(L, t->array, n, depth); break;
+    case SORTFLT: introsort_flt(L, t->array, n, depth); break;
+    default: introsort_gen(L, t->array, n, depth); break;
+  }
+  return 1;
+}
+
+
+/*
+** Stable sort of 't[1 .. n]' by the keys 'k[1 .. n]' ('k' may be 't'),
+** all in the array parts, under the same conditions on the keys as
+** 'luaH_sortarray'. The pairs are sorted in a temporary buffer; nothing
+** can raise an error after it is allocated.
+*/
+int luaH_sortarrayby (lua_State *L, Table *t, const Table *k,
+                                    unsigned int n) {
+  SortPair *buff;
+  unsigned int i, nbuff = n + n / 2;  /* pairs plus scratch */
+  int kind;
+  lua_assert(n <= t->sizearray && n <= k->sizearray);
+  kind = sortkind(k->array, n);
+  if (kind == 0)
+    return 0;
+  buff = luaM_newvector(L, nbuff, SortPair);
+  for (i = 0; i < n; i++) {
+    setobj(L, &buff[i].k, &k->array[i]);
+    setobj(L, &buff[i].v, &t->array[i]);
+  }
+  switch (kind) {
+    case SORTINT: msort_int(L, buff, n, buff + n); break;
+    case SORTFLT: msort_flt(L, buff, n, buff + n); break;
+    default: msort_gen(L, buff, n, buff + n); break;
+  }
+  for (i = 0; i < n; i++)
+    setobj2t(L, &t->array[i], &buff[i].v);
+  luaM_freearray(L, buff, nbuff);
+  return 1;
+}
+
+/* }============================================================= */
+
+
+
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if LUA_USE_SWISSTABLE  /* first node of first group in probe sequence */
+  return gnode(t, ((keyhash(key) >> 7) & (ngroups(t) - 1)) * GROUPW);
+#else
   return mainposition(t, key);
+#endif
 }
 
 int luaH_isdummy (const Table *t) { return isdummy(t); }
@@ -40,10 +40,25 @@
   (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
 
 
+/*
+** search for a short string using an inline cache: '*c' is the index of
+** the node where the key was last found. When that node does not have
+** the key (anymore), do a regular search and update the cache.
+*/
+#define luaH_getshortstrcached(t,key,c) \
+  ((*(c) < cast(unsigned int, sizenode(t)) && \
+    ttisshrstring(gkey(gnode(t, *(c)))) && \
+    eqshrstr(tsvalue(gkey(gnode(t, *(c)))), (key))) \
+   ? gval(gnode(t, *(c))) \
+   : luaH_getshortstrc(t, key, c))
+
+
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getshortstrc (Table *t, TString *key,
+                                                     unsigned int *c);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
@@ -52,7 +67,14 @@ LUAI_FUNC Table *luaH_new (lua_State *L);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC TValue *luaH_arrayrange (lua_State *L, Table *t, lua_Integer start,
+                                                           int n);
+LUAI_FUNC int luaH_sortarray (lua_State *L, Table *t, unsigned int n);
+LUAI_FUNC int luaH_sortarrayby (lua_State *L, Table *t, const Table *k,
+                                                   unsigned int n);
+LUAI_FUNC void luaH_clear (Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
+LUAI_FUNC void luaH_trimcache (lua_State *L);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
 
@@ -185,6 +185,31 @@ static int tconcat (lua_State *L) {
 }
 
 
+/*
+** table.create(narr [, nrec]): create a table with room for 'narr'
+** array elements and 'nrec' other fields
+*/
+static int tcreate (lua_State *L) {
+  lua_Integer narr = luaL_checkinteger(L, 1);
+  lua_Integer nrec = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= narr && narr <= INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nrec && nrec <= INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)narr, (int)nrec);
+  return 1;
+}
+
+
+/*
+** table.clear(t): remove all elements from 't' (ignoring metamethods),
+** keeping the memory allocated for them
+*/
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
 /*
 ** {======================================================
 ** Pack/unpack
@@ -223,6 +248,21 @@ static int unpack (lua_State *L) {
 
 
 
+/*
+** Check whether 't' has no metatable, so that raw accesses to it behave
+** like 'lua_geti'/'lua_seti'
+*/
+static int plaintable (lua_State *L) {
+  if (lua_type(L, 1) != LUA_TTABLE)
+    return 0;
+  if (lua_getmetatable(L, 1)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  return 1;
+}
+
+
 /*
 ** {======================================================
 ** Quicksort
@@ -408,23 +448,132 @@ static void auxsort (lua_State *L, IdxT lo, IdxT up,
 }
 
 
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Stable merge sort by key
+** =======================================================
+*/
+
+/*
+** With an options table, 'table.sort(t, {key = f, stable = true})', the
+** key function runs once per element and the elements are then stably
+** sorted by their keys with '<'. Keys are kept in a table; when 't' is
+** plain and the keys are all numbers or all strings, 'lua_rawsortby'
+** does the work, otherwise a merge sort over positions compares them
+** with 'lua_compare'.
+*/
+
+/* ranges up to this size are sorted by insertion */
+#define MSORTCUT	12
+
+
+/* key of position 'a' < key of position 'b'? ('ks' indexes the keys) */
+static int keylt (lua_State *L, int ks, IdxT a, IdxT b) {
+  int res;
+  lua_rawgeti(L, ks, a);
+  lua_rawgeti(L, ks, b);
+  res = lua_compare(L, -2, -1, LUA_OPLT);
+  lua_pop(L, 2);
+  return res;
+}
+
+
+/*
+** Stable merge sort of the positions 'p[0 .. n-1]' by their keys, with
+** 'w' (room for n/2 positions) as scratch. Halves already in order are
+** not merged, so (nearly) sorted input takes (nearly) linear time.
+*/
+static void mergesort (lua_State *L, int ks, IdxT *p, IdxT n, IdxT *w) {
+  IdxT i, j, m, o;
+  if (n <= MSORTCUT) {  /* insertion sort; stable with a strict '<' */
+    for (i = 1; i < n; i++) {
+      IdxT x = p[i];
+      for (j = i; j > 0 && keylt(L, ks, x, p[j - 1]); j--)
+        p[j] = p[j - 1];
+      p[j] = x;
+    }
+    return;
+  }
+  m = n / 2;
+  mergesort(L, ks, p, m, w);
+  mergesort(L, ks, p + m, n - m, w);
+  if (!keylt(L, ks, p[m], p[m - 1]))
+    return;  /* halves already in order */
+  memcpy(w, p, m * sizeof(IdxT));
+  for (i = 0, j = m, o = 0; i < m && j < n; o++)
+    p[o] = keylt(L, ks, p[j], w[i]) ? p[j++] : w[i++];
+  while (i < m) p[o++] = w[i++];  /* rest of the right half is in place */
+}
+
+
+/*
+** Sort 't' (with 'n' > 1 elements) as told by the options table at
+** index 2; return 0, doing nothing, when the options ask for neither a
+** key nor stability.
+*/
+static int keysort (lua_State *L, IdxT n) {
+  IdxT i, *p;
+  int haskey;
+  lua_settop(L, 2);
+  haskey = (lua_getfield(L, 2, "key") != LUA_TNIL);  /* index 3 */
+  lua_getfield(L, 2, "stable");  /* index 4 */
+  if (haskey)
+    luaL_argcheck(L, lua_isfunction(L, 3), 2, "'key' must be a function");
+  else if (!lua_toboolean(L, 4)) {
+    lua_settop(L, 1);
+    return 0;  /* plain sort */
+  }
+  lua_createtable(L, (int)n, 0);  /* keys at index 5 */
+  for (i = 1; i <= n; i++) {
+    if (haskey) lua_pushvalue(L, 3);
+    lua_geti(L, 1, i);
+    if (haskey) lua_call(L, 1, 1);  /* key = f(t[i]) */
+    lua_rawseti(L, 5, i);
+  }
+  if (plaintable(L) && lua_rawsortby(L, 1, 5, n))
+    return 1;  /* keys compared natively */
+  lua_createtable(L, (int)n, 0);  /* copy of the values at index 6 */
+  for (i = 1; i <= n; i++) {
+    lua_geti(L, 1, i);
+    lua_rawseti(L, 6, i);
+  }
+  p = (IdxT *)lua_newuserdata(L, (n + n / 2) * sizeof(IdxT));
+  for (i = 0; i < n; i++) p[i] = i + 1;
+  mergesort(L, 5, p, n, p + n);
+  for (i = 0; i < n; i++) {  /* t[i + 1] = old t[p[i]] */
+    lua_rawgeti(L, 6, p[i]);
+    lua_seti(L, 1, i + 1);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
 static int sort (lua_State *L) {
   lua_Integer n = aux_getn(L, 1, TAB_RW);
   if (n > 1) {  /* non-trivial interval? */
     luaL_argcheck(L, n < INT_MAX, 1, "array too big");
+    if (lua_type(L, 2) == LUA_TTABLE && keysort(L, (IdxT)n))  /* options? */
+      return 0;
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
+    else if (plaintable(L) && lua_rawsort(L, 1, n))
+      return 0;  /* plain array of numbers or strings sorted natively */
     lua_settop(L, 2);  /* make sure there are two arguments */
     auxsort(L, 1, (IdxT)n, 0);
   }
   return 0;
 }
 
-/* }====================================================== */
-
 
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
   {"concat", tconcat},
+  {"create", tcreate},
 #if defined(LUA_COMPAT_MAXN)
   {"maxn", maxn},
 #endif
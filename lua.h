@@ -55,6 +55,9 @@
 
 typedef struct lua_State lua_State;
 
+/* prototype tree shared among states (see 'lua_shareproto') */
+typedef struct lua_SharedProto lua_SharedProto;
+
 
 /*
 ** basic types
@@ -145,6 +148,7 @@ extern const char lua_ident[];
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
+LUA_API int        (lua_resetthread) (lua_State *L);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
 
@@ -162,6 +166,7 @@ LUA_API void  (lua_pushvalue) (lua_State *L, int idx);
 LUA_API void  (lua_rotate) (lua_State *L, int idx, int n);
 LUA_API void  (lua_copy) (lua_State *L, int fromidx, int toidx);
 LUA_API int   (lua_checkstack) (lua_State *L, int n);
+LUA_API int   (lua_setstackhint) (lua_State *L, int n);
 
 LUA_API void  (lua_xmove) (lua_State *from, lua_State *to, int n);
 
@@ -245,6 +250,10 @@ LUA_API int (lua_geti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawget) (lua_State *L, int idx);
 LUA_API int (lua_rawgeti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawgetp) (lua_State *L, int idx, const void *p);
+LUA_API int (lua_rawgetarray) (lua_State *L, int idx, lua_Integer start,
+                               int n, lua_Number *v);
+LUA_API int (lua_rawgetiarray) (lua_State *L, int idx, lua_Integer start,
+                                int n, lua_Integer *v);
 
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
 LUA_API void *(lua_newuserdata) (lua_State *L, size_t sz);
@@ -262,6 +271,17 @@ LUA_API void  (lua_seti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
+LUA_API void  (lua_rawsetarray) (lua_State *L, int idx, lua_Integer start,
+                                 int n, const lua_Number *v);
+LUA_API void  (lua_rawsetiarray) (lua_State *L, int idx, lua_Integer start,
+                                  int n, const lua_Integer *v);
+LUA_API void  (lua_rawsetsarray) (lua_State *L, int idx, lua_Integer start,
+                                  int n, const char *const *s,
+                                  const size_t *len);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
+LUA_API int   (lua_rawsort) (lua_State *L, int idx, lua_Integer n);
+LUA_API int   (lua_rawsortby) (lua_State *L, int idx, int kidx,
+                               lua_Integer n);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_setuservalue) (lua_State *L, int idx);
 
@@ -282,6 +302,11 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
+LUA_API lua_SharedProto *(lua_shareproto) (lua_State *L);
+LUA_API int   (lua_loadshared) (lua_State *L, lua_SharedProto *sp,
+                                const char *chunkname);
+LUA_API void  (lua_releaseshared) (lua_SharedProto *sp);
+
 
 /*
 ** coroutine functions
@@ -308,6 +333,10 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCPARALLEL		12
+#define LUA_GCBGFREE		13
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
@@ -72,6 +72,35 @@
 #endif
 
 
+/*
+@@ LUA_USE_JUMPTABLE selects direct-threaded dispatch in the main
+** interpreter loop: each opcode handler fetches the next instruction
+** and jumps through a table of label addresses ('goto *disptab[op]').
+** It needs the "labels as values" extension of GCC (and compatible
+** compilers); otherwise Lua uses the portable 'switch'.
+** Define it as 0 (e.g., -DLUA_USE_JUMPTABLE=0) to force the 'switch'.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__) && !defined(LUA_USE_C89)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_SWISSTABLE selects an open-addressing ("Swiss table") layout
+** for the hash part of tables: a byte of metadata per node lets a lookup
+** check a whole group of nodes (16 with SSE2, 8 otherwise) at once,
+** touching fewer cache lines on large tables. Define it as 1 to use it;
+** by default tables use chained scatter with Brent's variation.
+*/
+#if !defined(LUA_USE_SWISSTABLE)
+#define LUA_USE_SWISSTABLE	0
+#endif
+
+
 /*
 @@ LUA_C89_NUMBERS ensures that Lua uses the largest types available for
 ** C89 ('long' and 'double'); Windows always has '__int64', so it does
@@ -733,6 +762,37 @@
 #define LUA_EXTRASPACE		(sizeof(void *))
 
 
+/*
+@@ LUA_USE_THREADLOCK makes a state usable from several OS threads,
+** serializing them with a per-state mutex (POSIX threads only; it may
+** need an extra library: -lpthread). The mutex is reached through the
+** last pointer of the extra space, so this option enlarges that space;
+** its first 'sizeof(void *)' bytes are still free for the application.
+*/
+/* #define LUA_USE_THREADLOCK */
+
+#if defined(LUA_USE_THREADLOCK)
+#undef LUA_EXTRASPACE
+#define LUA_EXTRASPACE		(2 * sizeof(void *))
+#endif
+
+
+/*
+@@ LUA_USE_PARALLELGC allows the collector to use helper threads (POSIX
+** threads only; it may need an extra library: -lpthread). With 'lua_gc'
+** option LUA_GCPARALLEL, they mark objects while the program is stopped,
+** that is, in full collections and atomic phases. With LUA_GCBGFREE,
+** a thread frees the blocks of dead objects found by the sweep; this
+** option needs an allocator function that is thread safe (as the one
+** used by 'luaL_newstate', but not the one of 'luaL_newpooledstate'),
+** so only the host can set it, not 'collectgarbage'.
+@@ LUAI_MAXGCHELPERS limits the number of those helper threads.
+*/
+/* #define LUA_USE_PARALLELGC */
+
+#define LUAI_MAXGCHELPERS	63
+
+
 /*
 @@ LUA_IDSIZE gives the maximum size for the description of the source
 @@ of a function in debug information.
@@ -33,6 +33,9 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  int fixed;  /* true if vectors may point into the input buffer */
+  int aligned;  /* true if input is in the aligned format */
+  size_t offset;  /* bytes read so far */
 } LoadState;
 
 
@@ -51,12 +54,40 @@ static l_noret error(LoadState *S, const char *why) {
 static void LoadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated");
+  S->offset += size;
 }
 
 
 #define LoadVar(S,x)		LoadVector(S,&x,1)
 
 
+/*
+** In a zero-copy load, return the address of the next 'size' bytes of
+** input (and skip them) when they are contiguous in the reader's
+** current block and aligned for 'align'; otherwise, return NULL and
+** let the caller copy them.
+*/
+#define BorrowVector(S,t,n)	BorrowBlock(S,(n)*sizeof(t),sizeof(t))
+
+static const void *BorrowBlock (LoadState *S, size_t size, size_t align) {
+  ZIO *z = S->Z;
+  const char *p;
+  if (!S->fixed || size == 0)
+    return NULL;
+  if (z->n == 0 && luaZ_fill(z) != EOZ) {  /* at the end of a block? */
+    z->n++;  /* put back the character read by 'luaZ_fill' */
+    z->p--;
+  }
+  if (z->n < size || point2uint(z->p) % align != 0)
+    return NULL;
+  p = z->p;
+  z->p += size;
+  z->n -= size;
+  S->offset += size;
+  return p;
+}
+
+
 static lu_byte LoadByte (LoadState *S) {
   lu_byte x;
   LoadVar(S, x);
@@ -64,6 +95,17 @@ static lu_byte LoadByte (LoadState *S) {
 }
 
 
+/*
+** skip the padding that aligned dumps put before a vector
+*/
+static void LoadAlign (LoadState *S, size_t align) {
+  if (S->aligned) {
+    while (S->offset % align != 0)
+      LoadByte(S);
+  }
+}
+
+
 static int LoadInt (LoadState *S) {
   int x;
   LoadVar(S, x);
@@ -106,9 +148,20 @@ static TString *LoadString (LoadState *S) {
 
 static void LoadCode (LoadState *S, Proto *f) {
   int n = LoadInt(S);
-  f->code = luaM_newvector(S->L, n, Instruction);
-  f->sizecode = n;
-  LoadVector(S, f->code, n);
+  const void *b;
+  LoadAlign(S, sizeof(Instruction));
+  b = BorrowVector(S, Instruction, n);
+  if (b != NULL) {
+    f->code = cast(Instruction *, b);
+    f->fixed |= FIXEDCODE;
+    f->sizecode = n;
+  }
+  else {
+    f->code = luaM_newvector(S->L, n, Instruction);
+    f->sizecode = n;
+    LoadVector(S, f->code, n);
+  }
+  luaF_initicache(S->L, f);
 }
 
 
@@ -179,10 +232,20 @@ static void LoadUpvalues (LoadState *S, Proto *f) {
 
 static void LoadDebug (LoadState *S, Proto *f) {
   int i, n;
+  const void *b;
   n = LoadInt(S);
-  f->lineinfo = luaM_newvector(S->L, n, int);
-  f->sizelineinfo = n;
-  LoadVector(S, f->lineinfo, n);
+  LoadAlign(S, sizeof(int));
+  b = BorrowVector(S, int, n);
+  if (b != NULL) {
+    f->lineinfo = cast(int *, b);
+    f->fixed |= FIXEDLINES;
+    f->sizelineinfo = n;
+  }
+  else {
+    f->lineinfo = luaM_newvector(S->L, n, int);
+    f->sizelineinfo = n;
+    LoadVector(S, f->lineinfo, n);
+  }
   n = LoadInt(S);
   f->locvars = luaM_newvector(S->L, n, LocVar);
   f->sizelocvars = n;
@@ -237,8 +300,11 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, LUA_SIGNATURE + 1, "not a");  /* 1st char already checked */
   if (LoadByte(S) != LUAC_VERSION)
     error(S, "version mismatch in");
-  if (LoadByte(S) != LUAC_FORMAT)
-    error(S, "format mismatch in");
+  switch (LoadByte(S)) {
+    case LUAC_FORMAT: S->aligned = 0; break;
+    case LUAC_FORMATALIGNED: S->aligned = 1; break;
+    default: error(S, "format mismatch in");
+  }
   checkliteral(S, LUAC_DATA, "corrupted");
   checksize(S, int);
   checksize(S, size_t);
@@ -253,9 +319,11 @@ static void checkHeader (LoadState *S) {
 
 
 /*
-** load precompiled chunk
+** load precompiled chunk; if 'fixed', code and line information are
+** used in place from the input when the reader hands them back whole
+** and aligned, so that they are not copied into the Lua heap
 */
-LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
+LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name, int fixed) {
   LoadState S;
   LClosure *cl;
   if (*name == '@' || *name == '=')
@@ -266,6 +334,8 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.fixed = fixed;
+  S.offset = 1;  /* 1st char of signature already read */
   checkHeader(&S);
   cl = luaF_newLclosure(L, LoadByte(&S));
   setclLvalue(L, L->top, cl);